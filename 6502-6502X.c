@@ -0,0 +1,9 @@
+
+// NOTE: This file is specific to sim65-test; it has no counterpart in sim65.
+//
+// 6502.c, compiled for the 6502X only (see the comment at the top of 6502.c).
+
+#define SIM65_CPU_VARIANT       CPU_6502X
+#define SIM65_CPU_ENTRY(Name)   Name##6502X
+
+#include "6502.c"
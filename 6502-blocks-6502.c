@@ -0,0 +1,10 @@
+
+// NOTE: This file is specific to sim65-test; it has no counterpart in sim65.
+//
+// 6502.c, compiled for the block engine of the 6502 only (see the comment at the top of 6502.c).
+
+#define SIM65_CPU_VARIANT       CPU_6502
+#define SIM65_CPU_ENTRY(Name)   Name##6502
+#define SIM65_BLOCK_OPERANDS
+
+#include "6502.c"
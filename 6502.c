@@ -42,6 +42,17 @@
  * the WAI ($CB) and STP ($DB) instructions are unsupported.
  */
 
+/* This file is also compiled once for each CPU variant, by 6502-6502.c,
+ * 6502-65C02.c and 6502-6502X.c. These define SIM65_CPU_VARIANT as the
+ * variant, and SIM65_CPU_ENTRY(Name) to append the variant to a name. Such
+ * a compilation only defines the run loop of the variant (e.g.
+ * RunInsns65C02), in which all checks of the CPU variant are constant.
+ * The compilations by 6502-blocks-6502.c, 6502-blocks-65C02.c and
+ * 6502-blocks-6502X.c also define SIM65_BLOCK_OPERANDS, and only define
+ * the block engine of the variant (e.g. RunBlocks65C02), whose address
+ * and memory operators take their operands from the blocks.
+ */
+
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -49,6 +60,7 @@
 #include "peripherals.h"
 #include "error.h"
 #include "6502.h"
+#include "decimal.h"
 #include "paravirt.h"
 
 /*
@@ -388,23 +400,33 @@ SBC #imm     |   EBh  |  2     |
 
 
 
-/* Current CPU */
-CPUType CPU;
+#if !defined(SIM65_CPU_VARIANT)
 
-/* Type of an opcode handler function */
-typedef void (*OPFunc) (void);
+/* Current CPU */
+SIM65_THREAD_LOCAL CPUType CPU;
 
 /* The CPU registers */
-CPURegs Regs;
-
-/* Cycles for the current insn */
-static unsigned Cycles;
+SIM65_THREAD_LOCAL CPURegs Regs;
 
 /* NMI request active */
-static bool HaveNMIRequest;
+SIM65_THREAD_LOCAL bool HaveNMIRequest;
 
 /* IRQ request active */
-static bool HaveIRQRequest;
+SIM65_THREAD_LOCAL bool HaveIRQRequest;
+
+#else
+
+/* The interrupt requests are shared with the compilation for all variants */
+extern SIM65_THREAD_LOCAL bool HaveNMIRequest;
+extern SIM65_THREAD_LOCAL bool HaveIRQRequest;
+
+#endif
+
+/* Type of an opcode handler function */
+typedef void (*OPFunc) (void);
+
+/* Cycles for the current insn */
+static SIM65_THREAD_LOCAL unsigned Cycles;
 
 
 
@@ -414,6 +436,13 @@ static bool HaveIRQRequest;
 
 
 
+/* Check the CPU variant */
+#if defined(SIM65_CPU_VARIANT)
+#define CPU_IS(Type)    (SIM65_CPU_VARIANT == (Type))
+#else
+#define CPU_IS(Type)    (CPU == (Type))
+#endif
+
 /* Return the flags as boolean values (0/1) */
 #define GET_CF()        ((Regs.SR & CF) != 0)
 #define GET_ZF()        ((Regs.SR & ZF) != 0)
@@ -438,6 +467,12 @@ static bool HaveIRQRequest;
 #define TEST_ZF(v)      SET_ZF (((v) & 0xFF) == 0)
 #define TEST_SF(v)      SET_SF (((v) & 0x80) != 0)
 
+/* Set N and Z from an 8-bit result, with a lookup in NZFlags (decimal.h) */
+#define SET_NZ(v)       (Regs.SR = (Regs.SR & ~(SF | ZF)) | NZFlags[v])
+
+/* Set N, V, Z and C from their bits in a status register value */
+#define SET_NVZC(f)     (Regs.SR = (Regs.SR & ~(SF | OF | ZF | CF)) | (f))
+
 /* Program counter halves */
 #define PCL             (Regs.PC & 0xFF)
 #define PCH             ((Regs.PC >> 8) & 0xFF)
@@ -543,6 +578,102 @@ static bool HaveIRQRequest;
     ADR_##mode(ad);                                             \
     op = MemReadByte (ad)
 
+#if defined(SIM65_BLOCK_OPERANDS)
+
+/* The compilations for RunBlocks take the operand of the instruction from
+** BlockOperand, in which the block engine stores the operand bytes decoded
+** when the block was built, instead of reading them from memory. Only the
+** address and memory operators are redefined for that; all other handlers
+** read their operands from memory, as they do in ExecuteInsn.
+*/
+static SIM65_THREAD_LOCAL uint16_t BlockOperand;
+
+#define BLOCK_OPERAND_LO        ((uint8_t) BlockOperand)
+
+#undef ADR_ZP
+#undef ADR_ZPX
+#undef ADR_ZPY
+#undef ADR_ABS
+#undef ADR_ABSX
+#undef ADR_ABSY
+#undef ADR_ZPXIND
+#undef ADR_ZPINDY
+#undef ADR_ZPIND
+#undef ADR_ABSX_NP
+#undef ADR_ABSY_NP
+#undef ADR_ZPINDY_NP
+#undef MEM_AD_OP_IMM
+
+#define ADR_ZP(ad)                                              \
+    ad = BLOCK_OPERAND_LO;                                      \
+    Regs.PC += 2
+
+#define ADR_ZPX(ad)                                             \
+    ad = (BLOCK_OPERAND_LO + Regs.XR) & 0xFF;                   \
+    Regs.PC += 2
+
+#define ADR_ZPY(ad)                                             \
+    ad = (BLOCK_OPERAND_LO + Regs.YR) & 0xFF;                   \
+    Regs.PC += 2
+
+#define ADR_ABS(ad)                                             \
+    ad = BlockOperand;                                          \
+    Regs.PC += 3
+
+#define ADR_ABSX(ad)                                            \
+    ad = BlockOperand;                                          \
+    if (PAGE_CROSS (ad, Regs.XR)) {                             \
+        ++Cycles;                                               \
+    }                                                           \
+    ad += Regs.XR;                                              \
+    Regs.PC += 3
+
+#define ADR_ABSY(ad)                                            \
+    ad = BlockOperand;                                          \
+    if (PAGE_CROSS (ad, Regs.YR)) {                             \
+        ++Cycles;                                               \
+    }                                                           \
+    ad += Regs.YR;                                              \
+    Regs.PC += 3
+
+#define ADR_ZPXIND(ad)                                          \
+    ad = (BLOCK_OPERAND_LO + Regs.XR) & 0xFF;                   \
+    ad = MemReadZPWord (ad);                                    \
+    Regs.PC += 2
+
+#define ADR_ZPINDY(ad)                                          \
+    ad = MemReadZPWord (BLOCK_OPERAND_LO);                      \
+    if (PAGE_CROSS (ad, Regs.YR)) {                             \
+        ++Cycles;                                               \
+    }                                                           \
+    ad += Regs.YR;                                              \
+    Regs.PC += 2
+
+#define ADR_ZPIND(ad)                                           \
+    ad = MemReadZPWord (BLOCK_OPERAND_LO);                      \
+    Regs.PC += 2
+
+#define ADR_ABSX_NP(ad)                                         \
+    ad = BlockOperand;                                          \
+    ad += Regs.XR;                                              \
+    Regs.PC += 3
+
+#define ADR_ABSY_NP(ad)                                         \
+    ad = BlockOperand;                                          \
+    ad += Regs.YR;                                              \
+    Regs.PC += 3
+
+#define ADR_ZPINDY_NP(ad)                                       \
+    ad = MemReadZPWord (BLOCK_OPERAND_LO);                      \
+    ad += Regs.YR;                                              \
+    Regs.PC += 2
+
+#define MEM_AD_OP_IMM(op)                                       \
+    op = BLOCK_OPERAND_LO;                                      \
+    Regs.PC += 2
+
+#endif
+
 /* ALU opcode helpers */
 
 /* Execution cycles for ALU opcodes */
@@ -672,9 +803,8 @@ static bool HaveIRQRequest;
         Regs.AC = OldAC + op + carry;                           \
         const bool NV = Regs.AC >= 0x80;                        \
         carry = OldAC + op + carry >= 0x100;                    \
-        SET_SF(NV);                                             \
+        SET_NZ(Regs.AC);                                        \
         SET_OF(((OldAC >= 0x80) ^ NV) & ((op >= 0x80) ^ NV));   \
-        SET_ZF(Regs.AC == 0);                                   \
         SET_CF(carry);                                          \
     } while (0)
 
@@ -955,7 +1085,7 @@ static bool HaveIRQRequest;
             } else {                                            \
                 SET_CF(0);                                      \
             }                                                   \
-            if (CPU == CPU_65C02) {                             \
+            if (CPU_IS (CPU_65C02)) {                           \
                 ++Cycles;                                       \
             }                                                   \
         } else {                                                \
@@ -1039,9 +1169,8 @@ static bool HaveIRQRequest;
         const bool borrow = !GET_CF();                          \
         Regs.AC = OldAC - op - borrow;                          \
         const bool NV = Regs.AC >= 0x80;                        \
-        SET_SF(NV);                                             \
+        SET_NZ(Regs.AC);                                        \
         SET_OF(((OldAC >= 0x80) ^ NV) & ((op < 0x80) ^ NV));    \
-        SET_ZF(Regs.AC == 0);                                   \
         SET_CF(OldAC >= op + borrow);                           \
     } while (0)
 
@@ -1092,6 +1221,47 @@ static bool HaveIRQRequest;
         ++Cycles;                                               \
     } while (0)
 
+/* ADC and SBC, decimal mode: instead of executing the macros above, sim65-test
+** looks up the result and the N, V, Z and C flags in the tables of decimal.h.
+** sim65-gendecimal generates these tables by executing the macros above, in
+** a compilation of this file with SIM65_GENDECIMAL defined.
+*/
+#if !defined(SIM65_GENDECIMAL)
+
+#define DECIMAL_MODE(Table, v)                                  \
+    do {                                                        \
+        const uint8_t op = v;                                   \
+        const unsigned Entry =                                  \
+            Table[DECIMAL_INDEX (Regs.AC, op, GET_CF())];       \
+        Regs.AC = (uint8_t) Entry;                              \
+        SET_NVZC(Entry >> 8);                                   \
+    } while (0)
+
+#undef ADC_DECIMAL_MODE_6502
+#undef ADC_DECIMAL_MODE_65C02
+#undef SBC_DECIMAL_MODE_6502
+#undef SBC_DECIMAL_MODE_65C02
+
+#define ADC_DECIMAL_MODE_6502(v)                                \
+    DECIMAL_MODE(DecimalADC6502, v)
+
+#define ADC_DECIMAL_MODE_65C02(v)                               \
+    do {                                                        \
+        DECIMAL_MODE(DecimalADC65C02, v);                       \
+        ++Cycles;                                               \
+    } while (0)
+
+#define SBC_DECIMAL_MODE_6502(v)                                \
+    DECIMAL_MODE(DecimalSBC6502, v)
+
+#define SBC_DECIMAL_MODE_65C02(v)                               \
+    do {                                                        \
+        DECIMAL_MODE(DecimalSBC65C02, v);                       \
+        ++Cycles;                                               \
+    } while (0)
+
+#endif
+
 /* SBC, 6502 version */
 #define SBC_6502(v)                                             \
     do {                                                        \
@@ -1154,6 +1324,11 @@ static bool HaveIRQRequest;
         }                                                       \
     } while (0)
 
+/* sim65-gendecimal only needs the macros above */
+#if !defined(SIM65_GENDECIMAL)
+
+
+
 /*****************************************************************************/
 /*                         Opcode handling functions                         */
 /*****************************************************************************/
@@ -1177,7 +1352,7 @@ static void OPC_6502_00 (void)
     PUSH (PCL);
     PUSH (Regs.SR);
     SET_IF (1);
-    if (CPU == CPU_65C02)
+    if (CPU_IS (CPU_65C02))
     {
         SET_DF (0);
     }
@@ -4678,7 +4853,7 @@ static const OPFunc OP65C02Table[256] = {
 
 
 /* Tables with opcode handlers */
-static const OPFunc* Handlers[3] = {
+static const OPFunc* const Handlers[3] = {
     OP6502Table,
     OP65C02Table,
     OP6502XTable
@@ -4692,6 +4867,18 @@ static const OPFunc* Handlers[3] = {
 
 
 
+#if !defined(SIM65_CPU_VARIANT)
+
+/* The run loops of the CPU variants */
+uint64_t RunInsns6502 (uint64_t MaxCycles);
+uint64_t RunInsns65C02 (uint64_t MaxCycles);
+uint64_t RunInsns6502X (uint64_t MaxCycles);
+uint64_t RunBlocks6502 (uint64_t MaxCycles);
+uint64_t RunBlocks65C02 (uint64_t MaxCycles);
+uint64_t RunBlocks6502X (uint64_t MaxCycles);
+
+
+
 void IRQRequest (void)
 /* Generate an IRQ */
 {
@@ -4737,7 +4924,7 @@ unsigned ExecuteInsn (void)
         PUSH (PCL);
         PUSH (Regs.SR & ~BF);
         SET_IF (1);
-        if (CPU == CPU_65C02)
+        if (CPU_IS (CPU_65C02))
         {
             SET_DF (0);
         }
@@ -4753,7 +4940,7 @@ unsigned ExecuteInsn (void)
         PUSH (PCL);
         PUSH (Regs.SR & ~BF);
         SET_IF (1);
-        if (CPU == CPU_65C02)
+        if (CPU_IS (CPU_65C02))
         {
             SET_DF (0);
         }
@@ -4778,3 +4965,295 @@ unsigned ExecuteInsn (void)
     /* Return the number of clock cycles needed by this instruction */
     return Cycles;
 }
+
+
+
+uint64_t RunInsns (uint64_t MaxCycles)
+/* Execute CPU instructions until at least MaxCycles clock cycles have passed,
+** using the run loop of the current CPU.
+*/
+{
+    switch (CPU) {
+        case CPU_65C02:
+            return RunInsns65C02 (MaxCycles);
+        case CPU_6502X:
+            return RunInsns6502X (MaxCycles);
+        default:
+            return RunInsns6502 (MaxCycles);
+    }
+}
+
+
+
+uint64_t RunBlocks (uint64_t MaxCycles)
+/* Execute CPU instructions until at least MaxCycles clock cycles have passed,
+** from the cache of pre-decoded blocks of the current CPU.
+*/
+{
+    switch (CPU) {
+        case CPU_65C02:
+            return RunBlocks65C02 (MaxCycles);
+        case CPU_6502X:
+            return RunBlocks6502X (MaxCycles);
+        default:
+            return RunBlocks6502 (MaxCycles);
+    }
+}
+
+
+
+void FlushBlocks (void)
+/* Discard all blocks of RunBlocks */
+{
+    unsigned Page;
+
+    for (Page = 0; Page < 0x100; ++Page) {
+        MemPageWritten (Page << 8);
+    }
+
+    /* Until RunBlocks builds new blocks, writes don't need to be counted */
+    MemPageGenerationsEnable (false);
+}
+
+#elif defined(SIM65_BLOCK_OPERANDS)
+
+
+
+/* The cache of pre-decoded blocks of RunBlocks, one for each CPU variant.
+** A block is a run of up to BLOCK_MAX_INSNS instructions in one page, as
+** executed when the block was built, each with the address, the handler and
+** the operand of the instruction. It is cached in the entry for the address
+** of its first instruction, and valid as long as that page has the write
+** generation it had when the block was built.
+*/
+#define BLOCK_COUNT             1024
+#define BLOCK_MAX_INSNS         32
+
+typedef struct Block Block;
+struct Block {
+    uint32_t    Generation;                     /* Page generation when built */
+    uint16_t    PC;                             /* First instruction */
+    unsigned    Count;                          /* Number of instructions */
+    uint16_t    InsnPC[BLOCK_MAX_INSNS];        /* Address of each instruction */
+    uint16_t    InsnOperand[BLOCK_MAX_INSNS];   /* Operand of each instruction */
+    OPFunc      InsnHandler[BLOCK_MAX_INSNS];   /* Handler of each instruction */
+};
+
+static SIM65_THREAD_LOCAL Block Blocks[BLOCK_COUNT];
+
+
+
+uint64_t SIM65_CPU_ENTRY (RunBlocks) (uint64_t MaxCycles)
+/* Execute CPU instructions until at least MaxCycles clock cycles have passed,
+** from the cache of pre-decoded blocks. A block runs from the cache until
+** the program leaves it, writes to its page, or an interrupt is requested,
+** so this does exactly the same as calling ExecuteInsn in a loop.
+*/
+{
+    uint64_t TotalCycles = 0;
+    uint64_t InsnCycles = 0;
+    uint64_t Insns = 0;
+
+    /* Writes to code must invalidate the blocks built from it. The page
+    ** generations stay enabled while blocks are cached, until FlushBlocks,
+    ** so that writes made by ExecuteInsn and RunInsns in between count too.
+    */
+    MemPageGenerationsEnable (true);
+
+    while (TotalCycles < MaxCycles) {
+
+        const unsigned Page = Regs.PC >> 8;
+        Block* B = &Blocks[Regs.PC % BLOCK_COUNT];
+        unsigned I = 0;
+
+        if (HaveNMIRequest || HaveIRQRequest || (Regs.PC & 0xFF) >= 0xFE ||
+            (Page + 1) * 0x100 > MemReadFastLimit) {
+
+            /* Interrupts, instructions whose operand may be in the next
+            ** page, and pages whose reads must be seen by the slow accessor
+            ** are left to ExecuteInsn, which updates the counters itself.
+            */
+            TotalCycles += ExecuteInsn ();
+
+        } else if (B->PC == Regs.PC && B->Count != 0 &&
+                   B->Generation == MemPageGeneration[Page]) {
+
+            /* Run the block while the program follows it */
+            do {
+                BlockOperand = B->InsnOperand[I];
+                B->InsnHandler[I] ();
+
+                TotalCycles += Cycles;
+                InsnCycles += Cycles;
+                Insns += 1;
+
+            } while (++I < B->Count && Regs.PC == B->InsnPC[I] &&
+                     B->Generation == MemPageGeneration[Page] &&
+                     TotalCycles < MaxCycles &&
+                     !HaveNMIRequest && !HaveIRQRequest);
+
+        } else {
+
+            /* Build the block while executing its instructions. It ends
+            ** where the program leaves the page or returns to the start of
+            ** the block. If the program writes to the page, the block is no
+            ** longer valid, and is rebuilt the next time it is entered.
+            */
+            B->Generation = MemPageGeneration[Page];
+            B->PC = Regs.PC;
+            do {
+                const OPFunc Handler = Handlers[SIM65_CPU_VARIANT][Mem[Regs.PC]];
+
+                B->InsnPC[I] = Regs.PC;
+                B->InsnOperand[I] = Mem[Regs.PC + 1] | (Mem[Regs.PC + 2] << 8);
+                B->InsnHandler[I] = Handler;
+                B->Count = ++I;
+
+                BlockOperand = B->InsnOperand[I - 1];
+                Handler ();
+
+                TotalCycles += Cycles;
+                InsnCycles += Cycles;
+                Insns += 1;
+
+            } while (I < BLOCK_MAX_INSNS && (Regs.PC >> 8) == Page &&
+                     (Regs.PC & 0xFF) < 0xFE && Regs.PC != B->PC &&
+                     B->Generation == MemPageGeneration[Page] &&
+                     TotalCycles < MaxCycles &&
+                     !HaveNMIRequest && !HaveIRQRequest);
+        }
+    }
+
+    Peripherals.Counter.ClockCycles += InsnCycles;
+    Peripherals.Counter.CpuInstructions += Insns;
+
+    /* Return the number of clock cycles needed by these instructions */
+    return TotalCycles;
+}
+
+#else
+
+
+
+/* RunInsns uses threaded dispatch where the compiler supports labels as
+** values (GCC and clang): each opcode has a label of its own that executes
+** the handler, taken from the constant table of the variant so that the
+** compiler can inline it, and jumps to the label of the next opcode. As
+** every opcode ends in an indirect jump of its own, the branch predictor
+** can learn which opcodes tend to follow which.
+*/
+#if defined(__GNUC__) && !defined(SIM65_NO_THREADED_DISPATCH)
+#define THREADED_DISPATCH       1
+#endif
+
+#if defined(THREADED_DISPATCH)
+
+/* Apply X to the opcodes $00 to $FF, given as two hex digits */
+#define OPCODE_ROW(X, H)                                                    \
+    X (H##0) X (H##1) X (H##2) X (H##3) X (H##4) X (H##5) X (H##6) X (H##7) \
+    X (H##8) X (H##9) X (H##A) X (H##B) X (H##C) X (H##D) X (H##E) X (H##F)
+#define FOR_EACH_OPCODE(X)                                                  \
+    OPCODE_ROW (X, 0) OPCODE_ROW (X, 1) OPCODE_ROW (X, 2) OPCODE_ROW (X, 3) \
+    OPCODE_ROW (X, 4) OPCODE_ROW (X, 5) OPCODE_ROW (X, 6) OPCODE_ROW (X, 7) \
+    OPCODE_ROW (X, 8) OPCODE_ROW (X, 9) OPCODE_ROW (X, A) OPCODE_ROW (X, B) \
+    OPCODE_ROW (X, C) OPCODE_ROW (X, D) OPCODE_ROW (X, E) OPCODE_ROW (X, F)
+
+#define OPCODE_LABEL_ADDRESS(Op)        &&Opcode_##Op,
+
+#endif
+
+
+
+uint64_t SIM65_CPU_ENTRY (RunInsns) (uint64_t MaxCycles)
+/* Execute CPU instructions until at least MaxCycles clock cycles have passed.
+** This does the same as calling ExecuteInsn in a loop, but the handler table
+** of the CPU is known at compile time, interrupt requests are only handled by
+** ExecuteInsn when one is pending, and the instruction and clock cycle
+** counters are kept in locals until the end of the run.
+*/
+{
+    uint64_t TotalCycles = 0;
+    uint64_t InsnCycles = 0;
+    uint64_t Insns = 0;
+
+#if defined(THREADED_DISPATCH)
+
+    static const void* const Labels[256] = {
+        FOR_EACH_OPCODE (OPCODE_LABEL_ADDRESS)
+    };
+
+/* Count the instruction just executed, and continue with the next one */
+#define DISPATCH()                                                      \
+    do {                                                                \
+        TotalCycles += Cycles;                                          \
+        InsnCycles += Cycles;                                           \
+        Insns += 1;                                                     \
+        if (TotalCycles >= MaxCycles || HaveNMIRequest || HaveIRQRequest) { \
+            goto Interrupt;                                             \
+        }                                                               \
+        goto *Labels[MemReadByte (Regs.PC)];                            \
+    } while (0)
+
+#define OPCODE_LABEL(Op)                                                \
+    Opcode_##Op:                                                        \
+        Handlers[SIM65_CPU_VARIANT][0x##Op] ();                         \
+        DISPATCH ();
+
+    while (TotalCycles < MaxCycles) {
+
+        if (HaveNMIRequest || HaveIRQRequest) {
+
+            /* ExecuteInsn updates the counters itself */
+            TotalCycles += ExecuteInsn ();
+            continue;
+        }
+
+        /* Normal instruction - read the next opcode and jump to it. The
+        ** labels only return here to handle an interrupt request, or to
+        ** stop.
+        */
+        goto *Labels[MemReadByte (Regs.PC)];
+
+        FOR_EACH_OPCODE (OPCODE_LABEL)
+
+Interrupt:
+        ;
+    }
+
+#undef OPCODE_LABEL
+#undef DISPATCH
+
+#else
+
+    const OPFunc* Table = Handlers[SIM65_CPU_VARIANT];
+
+    while (TotalCycles < MaxCycles) {
+
+        if (HaveNMIRequest || HaveIRQRequest) {
+
+            /* ExecuteInsn updates the counters itself */
+            TotalCycles += ExecuteInsn ();
+
+        } else {
+
+            /* Normal instruction - read the next opcode and execute it */
+            Table[MemReadByte (Regs.PC)] ();
+
+            TotalCycles += Cycles;
+            InsnCycles += Cycles;
+            Insns += 1;
+        }
+    }
+
+#endif
+
+    Peripherals.Counter.ClockCycles += InsnCycles;
+    Peripherals.Counter.CpuInstructions += Insns;
+
+    /* Return the number of clock cycles needed by these instructions */
+    return TotalCycles;
+}
+
+#endif
+
+#endif /* !defined(SIM65_GENDECIMAL) */
@@ -39,6 +39,8 @@
 
 #include <stdint.h>
 
+#include "threadlocal.h"
+
 
 /*****************************************************************************/
 /*                                   Data                                    */
@@ -54,7 +56,7 @@ typedef enum CPUType {
 } CPUType;
 
 /* Current CPU */
-extern CPUType CPU;
+extern SIM65_THREAD_LOCAL CPUType CPU;
 
 /* 6502 CPU registers */
 typedef struct CPURegs CPURegs;
@@ -68,7 +70,7 @@ struct CPURegs {
 };
 
 /* Current CPU registers */
-extern CPURegs Regs;
+extern SIM65_THREAD_LOCAL CPURegs Regs;
 
 /* Status register bits */
 #define CF      0x01            /* Carry flag */
@@ -101,6 +103,26 @@ unsigned ExecuteInsn (void);
 ** executed instruction.
 */
 
+uint64_t RunInsns (uint64_t MaxCycles);
+/* Execute CPU instructions until at least MaxCycles clock cycles have passed.
+** Return the number of clock cycles. The counters of the Counter peripheral
+** are brought up to date on return.
+*/
+
+uint64_t RunBlocks (uint64_t MaxCycles);
+/* Like RunInsns, but execute the instructions from a cache of pre-decoded
+** blocks of code, which is faster for programs that loop. Writes invalidate
+** the blocks of the pages they write to (see MemPageGenerationsEnable, which
+** this enables until FlushBlocks is called), including those made by
+** ExecuteInsn and RunInsns in between. Writes made to Mem directly must be
+** reported with MemPageWritten, or by calling FlushBlocks.
+*/
+
+void FlushBlocks (void);
+/* Discard all blocks of RunBlocks, and disable the page generations until
+** RunBlocks is called again.
+*/
+
 
 /* End of 6502.h */
 
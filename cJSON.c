@@ -303,13 +303,63 @@ typedef struct
 /* get a pointer to the buffer at the position */
 #define buffer_at_offset(buffer) ((buffer)->content + (buffer)->offset)
 
+/* Parse a plain decimal integer that fits in an int, without going through strtod.
+ * Returns false, without consuming any input, if the number has a fraction or exponent, is too long, or is -0. */
+static cJSON_bool parse_integer(cJSON * const item, parse_buffer * const input_buffer)
+{
+    const unsigned char *digits = buffer_at_offset(input_buffer);
+    size_t available = input_buffer->length - input_buffer->offset;
+    size_t i = 0;
+    cJSON_bool negative = false;
+    long number = 0;
+
+    if ((available > 0) && (digits[0] == '-'))
+    {
+        negative = true;
+        i = 1;
+    }
+
+    /* at most 9 digits, so the value always fits in an int */
+    for (; (i < available) && (digits[i] >= '0') && (digits[i] <= '9'); i++)
+    {
+        if (i >= (negative ? 10 : 9))
+        {
+            return false;
+        }
+        number = (number * 10) + (digits[i] - '0');
+    }
+
+    if ((i == (negative ? 1 : 0)) || ((i < available) && ((digits[i] == '.') || (digits[i] == 'e') || (digits[i] == 'E'))))
+    {
+        return false;
+    }
+
+    /* -0 is a double that an int can't hold; leave it to strtod */
+    if (negative && (number == 0))
+    {
+        return false;
+    }
+
+    if (negative)
+    {
+        number = -number;
+    }
+
+    item->valuedouble = (double)number;
+    item->valueint = (int)number;
+    item->type = cJSON_Number;
+
+    input_buffer->offset += i;
+    return true;
+}
+
 /* Parse the input text to generate a number, and populate the result into item. */
 static cJSON_bool parse_number(cJSON * const item, parse_buffer * const input_buffer)
 {
     double number = 0;
     unsigned char *after_end = NULL;
     unsigned char number_c_string[64];
-    unsigned char decimal_point = get_decimal_point();
+    unsigned char decimal_point = 0;
     size_t i = 0;
 
     if ((input_buffer == NULL) || (input_buffer->content == NULL))
@@ -317,6 +367,14 @@ static cJSON_bool parse_number(cJSON * const item, parse_buffer * const input_bu
         return false;
     }
 
+    /* most numbers are small integers; those don't need strtod */
+    if (parse_integer(item, input_buffer))
+    {
+        return true;
+    }
+
+    decimal_point = get_decimal_point();
+
     /* copy the number into a temporary buffer and replace '.' with the decimal point
      * of the current locale (for strtod)
      * This also takes care of '\0' not necessarily being available for marking the end of the input */
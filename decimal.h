@@ -0,0 +1,30 @@
+// NOTE: This header is specific to sim65-test; it has no counterpart in sim65.
+//
+// Lookup tables for ADC and SBC in decimal mode, used by 6502.c. They are generated at build time by
+// sim65-gendecimal (see sim65-gendecimal.c), which computes every entry by executing the decimal mode macros of
+// 6502.c, and compiled from the generated decimal-tables.c.
+//
+// A decimal table is indexed by DECIMAL_INDEX(AC, Operand, Carry). Each entry holds the new accumulator in its
+// low byte, and the N, V, Z and C flags, at their positions in the status register, in its high byte. The
+// 6502 tables are also used by the 6502X.
+//
+// NZFlags holds the N and Z flags for each 8-bit result, at their positions in the status register, so that
+// ADC and SBC in binary mode can set both with a single lookup.
+
+#ifndef DECIMAL_H
+#define DECIMAL_H
+
+#include <stdint.h>
+
+#define DECIMAL_TABLE_SIZE              0x20000
+
+#define DECIMAL_INDEX(AC, Operand, Carry) (((unsigned) (Carry) << 16) | ((unsigned) (AC) << 8) | (Operand))
+
+extern const uint16_t DecimalADC6502[DECIMAL_TABLE_SIZE];
+extern const uint16_t DecimalADC65C02[DECIMAL_TABLE_SIZE];
+extern const uint16_t DecimalSBC6502[DECIMAL_TABLE_SIZE];
+extern const uint16_t DecimalSBC65C02[DECIMAL_TABLE_SIZE];
+
+extern const uint8_t NZFlags[0x100];
+
+#endif
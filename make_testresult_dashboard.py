@@ -1,11 +1,12 @@
 #! /usr/bin/env python3
 
-"""Parse the output of a 'test_legal_opcodes.py' run and generate an HTML table summarizing the results."""
+"""Read the results of a 'test_opcodes.py' run and generate an HTML table summarizing them."""
 
 import itertools
 import contextlib
+import json
+import os
 import sys
-import re
 from typing import NamedTuple
 
 class Result(NamedTuple):
@@ -13,20 +14,21 @@ class Result(NamedTuple):
     test_count: int
 
 def parse_file(filename: str):
+    """Read the file summary records from the output of 'sim65-test --output-format=jsonl'."""
 
-    pattern = re.compile(".*/([0-9a-f]{2})\\.json.*INFO - Test file summary: ([0-9]+) of ([0-9]+) .*", re.ASCII | re.DOTALL)
     results = {}
     summary_error_count = 0
     summary_test_count = 0
 
     with open(filename, "r") as fi:
         for line in fi:
-            match = pattern.fullmatch(line)
-            if match is None:
+            record = json.loads(line)
+            if "testcases" not in record:
                 continue
-            opcode = match.group(1)
-            error_count = int(match.group(2))
-            test_count = int(match.group(3))
+            # Test case files are named after the opcode they test, e.g. 'a9.json' or 'a9.bin'.
+            opcode = os.path.basename(record["file"]).split(".")[0]
+            error_count = record["failures"]
+            test_count = record["testcases"]
             results[opcode] = Result(error_count, test_count)
             summary_error_count += error_count
             summary_test_count += test_count
@@ -33,6 +33,7 @@
 
 
 
+#include <stdbool.h>
 #include <string.h>
 
 #include "memory.h"
@@ -46,7 +47,27 @@
 
 
 /* The memory */
-uint8_t Mem[0x10000];
+SIM65_THREAD_LOCAL uint8_t Mem[0x10000];
+
+/* The addresses from which accesses are made by the slow accessors */
+SIM65_THREAD_LOCAL uint32_t MemReadFastLimit = 0x10000;
+SIM65_THREAD_LOCAL uint32_t MemWriteFastLimit = 0x10000;
+
+/* The write generation of each page */
+SIM65_THREAD_LOCAL uint32_t MemPageGeneration[0x100];
+static SIM65_THREAD_LOCAL bool GenerationsEnabled;
+
+/* The write journal */
+static SIM65_THREAD_LOCAL bool JournalEnabled;
+static SIM65_THREAD_LOCAL bool JournalOverflow;
+static SIM65_THREAD_LOCAL unsigned JournalSize;
+static SIM65_THREAD_LOCAL uint16_t Journal[MEM_JOURNAL_CAPACITY];
+
+/* The bus trace */
+static SIM65_THREAD_LOCAL bool TraceEnabled;
+static SIM65_THREAD_LOCAL bool TraceOverflow;
+static SIM65_THREAD_LOCAL unsigned TraceSize;
+static SIM65_THREAD_LOCAL MemAccess Trace[MEM_TRACE_CAPACITY];
 
 
 
@@ -56,9 +77,48 @@ uint8_t Mem[0x10000];
 
 
 
-void MemWriteByte (uint16_t Addr, uint8_t Val)
-/* Write a byte to a memory location */
+static void UpdateFastLimits (void)
+/* Send all accesses that the journal, the trace or the page generations must
+** see to the slow accessors
+*/
+{
+    MemReadFastLimit = TraceEnabled ? 0 : 0x10000;
+    MemWriteFastLimit = (TraceEnabled || JournalEnabled || GenerationsEnabled) ? 0 : 0x10000;
+}
+
+
+
+static void TraceAccess (uint16_t Addr, uint8_t Val, bool Write)
+/* Add an access to the bus trace */
 {
+    if (TraceSize < MEM_TRACE_CAPACITY) {
+        MemAccess* A = &Trace[TraceSize++];
+        A->Addr  = Addr;
+        A->Val   = Val;
+        A->Write = Write;
+    } else {
+        TraceOverflow = true;
+    }
+}
+
+
+
+void MemWriteByteSlow (uint16_t Addr, uint8_t Val)
+/* Write a byte to a memory location at or above MemWriteFastLimit */
+{
+    if (JournalEnabled) {
+        if (JournalSize < MEM_JOURNAL_CAPACITY) {
+            Journal[JournalSize++] = Addr;
+        } else {
+            JournalOverflow = true;
+        }
+    }
+    if (TraceEnabled) {
+        TraceAccess (Addr, Val, true);
+    }
+    if (GenerationsEnabled) {
+        ++MemPageGeneration[Addr >> 8];
+    }
     Mem[Addr] = Val;
 }
 
@@ -73,38 +133,124 @@ void MemWriteWord (uint16_t Addr, uint16_t Val)
 
 
 
-uint8_t MemReadByte (uint16_t Addr)
-/* Read a byte from a memory location */
+uint8_t MemReadByteSlow (uint16_t Addr)
+/* Read a byte from a memory location at or above MemReadFastLimit */
 {
+    if (TraceEnabled) {
+        TraceAccess (Addr, Mem[Addr], false);
+    }
     return Mem[Addr];
 }
 
 
 
-uint16_t MemReadWord (uint16_t Addr)
-/* Read a word from a memory location */
+void MemInit (void)
+/* Initialize the memory subsystem */
 {
-    uint8_t W = MemReadByte (Addr++);
-    return (W | (MemReadByte (Addr) << 8));
+    /* Fill memory with illegal opcode */
+    memset (Mem, 0xFF, sizeof (Mem));
 }
 
 
 
-uint16_t MemReadZPWord (uint8_t Addr)
-/* Read a word from the zero page. This function differs from MemReadWord in that
-** the read will always be in the zero page, even in case of an address
-** overflow.
+void MemJournalEnable (bool Enable)
+/* Enable or disable the write journal. Enabling the journal clears it. */
+{
+    JournalEnabled = Enable;
+    UpdateFastLimits ();
+    MemJournalClear ();
+}
+
+
+
+void MemJournalClear (void)
+/* Remove all entries from the write journal */
+{
+    JournalSize = 0;
+    JournalOverflow = false;
+}
+
+
+
+unsigned MemJournalGetSize (void)
+/* Return the number of entries in the write journal */
+{
+    return JournalSize;
+}
+
+
+
+const uint16_t* MemJournalGetEntries (void)
+/* Return the addresses recorded in the write journal, in the order in which
+** they were written. An address that was written more than once may appear
+** more than once.
 */
 {
-    uint8_t W = MemReadByte (Addr++);
-    return (W | (MemReadByte (Addr) << 8));
+    return Journal;
 }
 
 
 
-void MemInit (void)
-/* Initialize the memory subsystem */
+bool MemJournalOverflowed (void)
+/* Return true if more writes were made than the journal can hold since it was
+** last cleared. In that case, the journal is incomplete.
+*/
 {
-    /* Fill memory with illegal opcode */
-    memset (Mem, 0xFF, sizeof (Mem));
+    return JournalOverflow;
+}
+
+
+
+void MemTraceEnable (bool Enable)
+/* Enable or disable the bus trace. Enabling the trace clears it. */
+{
+    TraceEnabled = Enable;
+    UpdateFastLimits ();
+    MemTraceClear ();
+}
+
+
+
+void MemTraceClear (void)
+/* Remove all entries from the bus trace */
+{
+    TraceSize = 0;
+    TraceOverflow = false;
+}
+
+
+
+unsigned MemTraceGetSize (void)
+/* Return the number of entries in the bus trace */
+{
+    return TraceSize;
+}
+
+
+
+const MemAccess* MemTraceGetEntries (void)
+/* Return the accesses recorded in the bus trace, oldest first */
+{
+    return Trace;
+}
+
+
+
+bool MemTraceOverflowed (void)
+/* Return true if more accesses were made than the trace can hold since it was
+** last cleared. In that case, the trace holds just the first accesses.
+*/
+{
+    return TraceOverflow;
+}
+
+
+
+void MemPageGenerationsEnable (bool Enable)
+/* Enable or disable the page generations */
+{
+    if (Enable != GenerationsEnabled) {
+        GenerationsEnabled = Enable;
+        UpdateFastLimits ();
+    }
 }
@@ -36,9 +36,41 @@
 #ifndef MEMORY_H
 #define MEMORY_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
-extern uint8_t Mem[0x10000];
+#include "threadlocal.h"
+
+extern SIM65_THREAD_LOCAL uint8_t Mem[0x10000];
+
+/* Reads from addresses below MemReadFastLimit, and writes to addresses below
+** MemWriteFastLimit, are plain accesses of Mem, made by the inline accessors
+** below. All other accesses are handed to MemReadByteSlow and
+** MemWriteByteSlow. The limits are 0x10000 (no slow accesses) unless the
+** write journal or the bus trace is enabled, which are only maintained by
+** the slow accessors. A memory map with I/O at the top of the address space,
+** such as the peripheral aperture of sim65, would lower them to the start
+** of the I/O range, so that a single compare sends I/O out of line.
+*/
+extern SIM65_THREAD_LOCAL uint32_t MemReadFastLimit;
+extern SIM65_THREAD_LOCAL uint32_t MemWriteFastLimit;
+
+/* The write generation of each 256-byte page (see MemPageGenerationsEnable) */
+extern SIM65_THREAD_LOCAL uint32_t MemPageGeneration[0x100];
+
+/* Number of writes the write journal can hold before it overflows */
+#define MEM_JOURNAL_CAPACITY    256
+
+/* Number of accesses the bus trace can hold before it overflows */
+#define MEM_TRACE_CAPACITY      64
+
+/* A memory access recorded by the bus trace */
+typedef struct MemAccess MemAccess;
+struct MemAccess {
+    uint16_t    Addr;
+    uint8_t     Val;
+    bool        Write;
+};
 
 /*****************************************************************************/
 /*                                   Code                                    */
@@ -46,27 +78,132 @@ extern uint8_t Mem[0x10000];
 
 
 
-void MemWriteByte (uint16_t Addr, uint8_t Val);
+void MemWriteByteSlow (uint16_t Addr, uint8_t Val);
+/* Write a byte to a memory location at or above MemWriteFastLimit */
+
+uint8_t MemReadByteSlow (uint16_t Addr);
+/* Read a byte from a memory location at or above MemReadFastLimit */
+
+static inline void MemWriteByte (uint16_t Addr, uint8_t Val)
 /* Write a byte to a memory location */
+{
+    if (Addr < MemWriteFastLimit) {
+        Mem[Addr] = Val;
+    } else {
+        MemWriteByteSlow (Addr, Val);
+    }
+}
 
 void MemWriteWord (uint16_t Addr, uint16_t Val);
 /* Write a word to a memory location */
 
-uint8_t MemReadByte (uint16_t Addr);
+static inline uint8_t MemReadByte (uint16_t Addr)
 /* Read a byte from a memory location */
-
-uint16_t MemReadWord (uint16_t Addr);
+{
+    if (Addr < MemReadFastLimit) {
+        return Mem[Addr];
+    }
+    return MemReadByteSlow (Addr);
+}
+
+static inline uint16_t MemReadWord (uint16_t Addr)
 /* Read a word from a memory location */
-
-uint16_t MemReadZPWord (uint8_t Addr);
+{
+    /* If both bytes are below the limit, this compiles to a single load */
+    if (Addr + 1u < MemReadFastLimit) {
+        return Mem[Addr] | (Mem[Addr + 1] << 8);
+    } else {
+        uint8_t W = MemReadByte (Addr++);
+        return (W | (MemReadByte (Addr) << 8));
+    }
+}
+
+static inline uint16_t MemReadZPWord (uint8_t Addr)
 /* Read a word from the zero page. This function differs from MemReadWord in that
 ** the read will always be in the zero page, even in case of an address
 ** overflow.
 */
+{
+    if (0x100u <= MemReadFastLimit) {
+        return Mem[Addr] | (Mem[(uint8_t) (Addr + 1)] << 8);
+    } else {
+        uint8_t W = MemReadByte (Addr++);
+        return (W | (MemReadByte (Addr) << 8));
+    }
+}
 
 void MemInit (void);
 /* Initialize the memory subsystem */
 
+/* The write journal records the address of every write made through
+** MemWriteByte and MemWriteWord while it is enabled. This allows a caller
+** to find, restore or verify just the memory locations that were modified,
+** rather than all of memory. The journal is disabled by default.
+*/
+
+void MemJournalEnable (bool Enable);
+/* Enable or disable the write journal. Enabling the journal clears it. */
+
+void MemJournalClear (void);
+/* Remove all entries from the write journal */
+
+unsigned MemJournalGetSize (void);
+/* Return the number of entries in the write journal */
+
+const uint16_t* MemJournalGetEntries (void);
+/* Return the addresses recorded in the write journal, in the order in which
+** they were written. An address that was written more than once may appear
+** more than once.
+*/
+
+bool MemJournalOverflowed (void);
+/* Return true if more writes were made than the journal can hold since it was
+** last cleared. In that case, the journal is incomplete.
+*/
+
+/* The bus trace records every read and write made through MemReadByte and
+** MemWriteByte (and the word accessors built on them) while it is enabled,
+** in the order in which they were made. The trace is disabled by default;
+** while it is, reads take the inline fast path (see MemReadFastLimit).
+*/
+
+void MemTraceEnable (bool Enable);
+/* Enable or disable the bus trace. Enabling the trace clears it. */
+
+void MemTraceClear (void);
+/* Remove all entries from the bus trace */
+
+unsigned MemTraceGetSize (void);
+/* Return the number of entries in the bus trace */
+
+const MemAccess* MemTraceGetEntries (void);
+/* Return the accesses recorded in the bus trace, oldest first */
+
+bool MemTraceOverflowed (void);
+/* Return true if more accesses were made than the trace can hold since it was
+** last cleared. In that case, the trace holds just the first accesses.
+*/
+
+/* While the page generations are enabled, every write made through
+** MemWriteByte and MemWriteWord increments the generation of the page that
+** it writes to, so that code that caches the contents of a page can tell
+** whether the page was written since. Writes made to Mem directly, or while
+** the generations are disabled, are not counted; MemPageWritten counts them.
+** The page generations are disabled by default; while they are enabled,
+** writes take the slow path.
+*/
+
+void MemPageGenerationsEnable (bool Enable);
+/* Enable or disable the page generations */
+
+static inline void MemPageWritten (uint16_t Addr)
+/* Increment the generation of the page holding Addr, after writing to it
+** in a way that the page generations don't see
+*/
+{
+    ++MemPageGeneration[Addr >> 8];
+}
+
 
 
 /* End of memory.h */
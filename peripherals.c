@@ -46,7 +46,7 @@
 
 
 /* The system-wide state of the peripherals */
-Sim65Peripherals Peripherals;
+SIM65_THREAD_LOCAL Sim65Peripherals Peripherals;
 
 
 
@@ -35,6 +35,8 @@
 
 #include <stdint.h>
 
+#include "threadlocal.h"
+
 /* The memory range where the memory-mapped peripherals can be accessed. */
 
 #define PERIPHERALS_APERTURE_BASE_ADDRESS  0xffc0
@@ -94,7 +96,7 @@ typedef struct {
     CounterPeripheral Counter;
 } Sim65Peripherals;
 
-extern Sim65Peripherals Peripherals;
+extern SIM65_THREAD_LOCAL Sim65Peripherals Peripherals;
 
 /*****************************************************************************/
 /*                                   Code                                    */
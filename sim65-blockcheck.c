@@ -0,0 +1,474 @@
+
+////////////////////////
+// sim65-blockcheck.c //
+////////////////////////
+
+// Check of the block engine (RunBlocks) against ExecuteInsn.
+//
+// Usage: sim65-blockcheck [--programs=N] [--seed=S]
+//
+// The 65x02 test suite executes a single instruction per test case, so it cannot tell whether RunBlocks notices
+// that a cached block was overwritten. sim65-blockcheck runs whole programs instead, once with ExecuteInsn and once
+// with RunBlocks, in slices of a random number of cycles, and compares the registers, the memory and the cycle
+// count at the end:
+//
+// - a self-modifying program, which patches the operand of an instruction and an opcode in the block that it is
+//   executing, in a loop;
+//
+// - random programs for each CPU, made of the common opcodes, with stores that often hit the program itself. Between
+//   the slices, the check writes to the program directly (reporting that with MemPageWritten), and requests an IRQ
+//   and an NMI at random moments.
+//
+// Loading a program writes all of memory directly, so the blocks cached by RunBlocks are flushed then. As in sim65,
+// whose Error() ends the process, a run ends where the program executes an illegal opcode.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <errno.h>
+#include <setjmp.h>
+
+#include "6502.h"
+#include "memory.h"
+
+/////////////////////////////////////////////////////////////////// start of re-implementation of functions that are called from 6502.c.
+
+void ParaVirtHooks(CPURegs * Regs)
+{
+    (void)Regs;
+}
+
+// Where Error() ends the run; see execute_run().
+static jmp_buf * error_exit;
+
+void Error(const char * Format, ...)
+{
+    (void)Format;
+    longjmp(*error_exit, 1);
+}
+
+void Warning(const char * Format, ...)
+{
+    (void)Format;
+}
+
+/////////////////////////////////////////////////////////////////// end of re-implementation of functions that are called from 6502.c.
+
+// Random numbers (xorshift64*), as in sim65-fuzz.c.
+
+static uint64_t random_state;
+
+static uint64_t random_next(void)
+{
+    random_state ^= random_state >> 12;
+    random_state ^= random_state << 25;
+    random_state ^= random_state >> 27;
+    return random_state * 0x2545f4914f6cdd1dULL;
+}
+
+static unsigned random_below(unsigned n)
+{
+    return (random_next() >> 32) % n;
+}
+
+// The programs live in pages 2 to 5.
+
+#define PROGRAM_START       0x0200
+#define PROGRAM_END         0x0600
+
+// Self-modifying programs (for the 6502, and valid on the 65C02 and 6502X).
+//
+// The first one patches the operand of the instruction after the store, and an opcode that it executes next:
+//
+//   0200  LDX #$00
+//   0202  INX             ; loop
+//   0203  STX $0207       ; patch the operand of the LDA below
+//   0206  LDA #$00
+//   0208  STA $0300,X
+//   020B  CPX #$10
+//   020D  BNE $0202
+//   020F  LDA #$C8        ; INY
+//   0211  STA $0216       ; patch the opcode at $0216
+//   0214  LDY #$00
+//   0216  NOP             ; INY, then DEY
+//   0217  LDA $0216
+//   021A  CMP #$88
+//   021C  BEQ $0226
+//   021E  LDA #$88        ; DEY
+//   0220  STA $0216
+//   0223  JMP $0216
+//   0226  JMP $0226       ; done
+//
+// As the first one writes to its page on every pass of its loops, its blocks are rebuilt every time. The second one
+// stores through a pointer that moves by $20 on every pass, from page 1 into page 2, so its first write to its own
+// page is made by a block that runs from the cache. That write patches the operand of the next instruction but one:
+//
+//   0200  LDA #$7D
+//   0202  STA $10
+//   0204  LDA #$01
+//   0206  STA $11         ; ($10) = $017D
+//   0208  LDX #$00
+//   020A  LDA $10         ; loop
+//   020C  CLC
+//   020D  ADC #$20
+//   020F  STA $10
+//   0211  LDA $11
+//   0213  ADC #$00
+//   0215  STA $11         ; ($10) = $019D, $01BD, $01DD, $01FD, $021D, ...
+//   0217  TXA
+//   0218  LDY #$00
+//   021A  STA ($10),Y     ; in the fifth pass, patch the operand of the LDA below
+//   021C  LDA #$00
+//   021E  STA $0300,X
+//   0221  INX
+//   0222  CPX #$08
+//   0224  BNE $020A
+//   0226  JMP $0226       ; done
+
+static const uint8_t self_modifying_program_1[] = {
+    0xa2, 0x00, 0xe8, 0x8e, 0x07, 0x02, 0xa9, 0x00, 0x9d, 0x00, 0x03, 0xe0, 0x10, 0xd0, 0xf3,
+    0xa9, 0xc8, 0x8d, 0x16, 0x02, 0xa0, 0x00, 0xea, 0xad, 0x16, 0x02, 0xc9, 0x88, 0xf0, 0x08,
+    0xa9, 0x88, 0x8d, 0x16, 0x02, 0x4c, 0x16, 0x02, 0x4c, 0x26, 0x02
+};
+
+static const uint8_t self_modifying_program_2[] = {
+    0xa9, 0x7d, 0x85, 0x10, 0xa9, 0x01, 0x85, 0x11, 0xa2, 0x00, 0xa5, 0x10, 0x18, 0x69, 0x20, 0x85,
+    0x10, 0xa5, 0x11, 0x69, 0x00, 0x85, 0x11, 0x8a, 0xa0, 0x00, 0x91, 0x10, 0xa9, 0x00, 0x9d, 0x00,
+    0x03, 0xe8, 0xe0, 0x08, 0xd0, 0xe4, 0x4c, 0x26, 0x02
+};
+
+// Opcodes that random programs are mostly made of, and those among them that store to an absolute address.
+static const uint8_t common_opcodes[] = {
+    0xa9, 0x85, 0x95, 0x9d, 0x99, 0xe8, 0xc8, 0xca, 0x88, 0xd0, 0xf0, 0x10, 0x30, 0x69, 0xe9, 0x4c, 0x20, 0x60,
+    0xee, 0xce, 0x91, 0x81, 0x8d, 0xad, 0xbd, 0x18, 0x38, 0xf8, 0xd8, 0x48, 0x68, 0x08, 0x28, 0x40, 0x00
+};
+
+static bool is_absolute_store(uint8_t opcode)
+{
+    return opcode == 0x8d || opcode == 0x9d || opcode == 0x99 || opcode == 0xee || opcode == 0xce;
+}
+
+static void random_program(uint8_t * memory)
+{
+    for (unsigned address = 0; address < 0x10000; ++address)
+    {
+        memory[address] = random_next() >> 56;
+    }
+
+    for (unsigned address = PROGRAM_START; address < PROGRAM_END; ++address)
+    {
+        if (random_below(4) != 0)
+        {
+            memory[address] = common_opcodes[random_below(sizeof(common_opcodes))];
+        }
+    }
+
+    // Make half of the absolute stores write to the program.
+    for (unsigned address = PROGRAM_START; address + 2 < PROGRAM_END; ++address)
+    {
+        if (is_absolute_store(memory[address]) && random_below(2) == 0)
+        {
+            memory[address + 2] = (PROGRAM_START >> 8) + random_below((PROGRAM_END - PROGRAM_START) >> 8);
+        }
+    }
+
+    memory[0xfffc] = PROGRAM_START & 0xff;
+    memory[0xfffd] = PROGRAM_START >> 8;
+}
+
+// What happens between the slices of a run; the same for both runs.
+struct event_type
+{
+    uint64_t cycle;     // The events of a slice happen once the run has passed this many cycles.
+    uint16_t address;   // Address of the direct write.
+    uint8_t value;      // Value of the direct write.
+    bool irq;           // Request an IRQ.
+    bool nmi;           // Request an NMI.
+};
+
+#define MAX_EVENTS 64
+
+struct run_type
+{
+    CPUType cpu;
+    const uint8_t * memory;             // The initial memory.
+    uint64_t cycles;                    // Run for at least this many cycles.
+    unsigned event_count;
+    struct event_type events[MAX_EVENTS];
+};
+
+struct outcome_type
+{
+    CPURegs regs;
+    uint64_t cycles;            // Up to the end of the last slice that the run completed.
+    bool illegal;               // The run ended at an illegal opcode.
+    uint8_t memory[0x10000];
+};
+
+// Execute the slices of a run. The cycle count of the outcome is only brought up to date at the end of each slice,
+// as RunBlocks doesn't return if the program executes an illegal opcode.
+static void execute_slices(const struct run_type * run, bool use_blocks, struct outcome_type * outcome)
+{
+    for (unsigned event_index = 0; event_index <= run->event_count; ++event_index)
+    {
+        uint64_t target = (event_index < run->event_count) ? run->events[event_index].cycle : run->cycles;
+        uint64_t cycles = outcome->cycles;
+
+        if (use_blocks)
+        {
+            if (cycles < target)
+            {
+                cycles += RunBlocks(target - cycles);
+            }
+        }
+        else
+        {
+            while (cycles < target)
+            {
+                cycles += ExecuteInsn();
+            }
+        }
+
+        outcome->cycles = cycles;
+
+        if (event_index < run->event_count)
+        {
+            const struct event_type * event = &run->events[event_index];
+
+            Mem[event->address] = event->value;
+            MemPageWritten(event->address);
+
+            if (event->irq)
+            {
+                IRQRequest();
+            }
+
+            if (event->nmi)
+            {
+                NMIRequest();
+            }
+        }
+    }
+}
+
+static void execute_run(const struct run_type * run, bool use_blocks, struct outcome_type * outcome)
+{
+    memcpy(Mem, run->memory, 0x10000);
+    FlushBlocks();
+
+    CPU = run->cpu;
+    Reset();
+
+    Regs.AC = 0;
+    Regs.XR = 0;
+    Regs.YR = 0;
+    Regs.SP = 0xff;
+
+    outcome->cycles = 0;
+    outcome->illegal = false;
+
+    jmp_buf run_exit;
+    error_exit = &run_exit;
+
+    if (setjmp(run_exit) == 0)
+    {
+        execute_slices(run, use_blocks, outcome);
+    }
+    else
+    {
+        outcome->illegal = true;
+    }
+
+    outcome->regs = Regs;
+    memcpy(outcome->memory, Mem, 0x10000);
+}
+
+static bool check_run(const struct run_type * run, const char * name)
+{
+    static struct outcome_type expected;
+    static struct outcome_type outcome;
+
+    execute_run(run, false, &expected);
+    execute_run(run, true, &outcome);
+
+    const CPURegs * e = &expected.regs;
+    const CPURegs * o = &outcome.regs;
+
+    bool registers_differ = e->AC != o->AC || e->XR != o->XR || e->YR != o->YR || e->SR != o->SR || e->SP != o->SP || e->PC != o->PC;
+    bool cycles_differ = expected.cycles != outcome.cycles || expected.illegal != outcome.illegal;
+    bool memory_differs = memcmp(expected.memory, outcome.memory, 0x10000) != 0;
+
+    if (!registers_differ && !cycles_differ && !memory_differs)
+    {
+        return true;
+    }
+
+    printf("%s: RunBlocks differs from ExecuteInsn (ExecuteInsn / RunBlocks):\n", name);
+    printf("  A %02x / %02x, X %02x / %02x, Y %02x / %02x, P %02x / %02x, S %02x / %02x, PC %04x / %04x, cycles %llu / %llu%s%s\n",
+           e->AC, o->AC, e->XR, o->XR, e->YR, o->YR, e->SR, o->SR, e->SP, o->SP, e->PC, o->PC,
+           (unsigned long long)expected.cycles, (unsigned long long)outcome.cycles,
+           expected.illegal ? ", ExecuteInsn ended at an illegal opcode" : "", outcome.illegal ? ", RunBlocks ended at an illegal opcode" : "");
+
+    for (unsigned address = 0; address < 0x10000; ++address)
+    {
+        if (expected.memory[address] != outcome.memory[address])
+        {
+            printf("  first memory difference at 0x%04x: 0x%02x / 0x%02x\n", address, expected.memory[address], outcome.memory[address]);
+            break;
+        }
+    }
+
+    return false;
+}
+
+static bool check_self_modifying_program(CPUType cpu, const char * cpu_name, const uint8_t * program, unsigned program_size,
+                                         unsigned program_number)
+{
+    static uint8_t memory[0x10000];
+
+    memset(memory, 0, sizeof(memory));
+    memcpy(memory + PROGRAM_START, program, program_size);
+    memory[0xfffc] = PROGRAM_START & 0xff;
+    memory[0xfffd] = PROGRAM_START >> 8;
+
+    struct run_type run = { cpu, memory, 2000, 0, { { 0, 0, 0, false, false } } };
+
+    char name[48];
+    snprintf(name, sizeof(name), "%s: self-modifying program %u", cpu_name, program_number);
+
+    return check_run(&run, name);
+}
+
+static bool check_random_program(CPUType cpu, const char * cpu_name, unsigned long long program_index)
+{
+    static uint8_t memory[0x10000];
+    static struct run_type run;
+
+    random_program(memory);
+
+    run.cpu = cpu;
+    run.memory = memory;
+    run.cycles = 20000;
+    run.event_count = random_below(MAX_EVENTS + 1);
+
+    // The events happen at increasing cycles; the slices in between are 1 to 2000 cycles.
+    uint64_t cycle = 0;
+    unsigned irq_index = random_below(run.event_count + 1);
+    unsigned nmi_index = random_below(run.event_count + 1);
+
+    for (unsigned event_index = 0; event_index < run.event_count; ++event_index)
+    {
+        struct event_type * event = &run.events[event_index];
+
+        cycle += 1 + random_below(2000);
+
+        event->cycle = cycle;
+        event->address = PROGRAM_START + random_below(PROGRAM_END - PROGRAM_START);
+        event->value = (random_below(2) == 0) ? common_opcodes[random_below(sizeof(common_opcodes))] : random_next() >> 56;
+        event->irq = (event_index == irq_index);
+        event->nmi = (event_index == nmi_index);
+    }
+
+    if (run.cycles < cycle)
+    {
+        run.cycles = cycle;
+    }
+
+    char name[48];
+    snprintf(name, sizeof(name), "%s: random program %llu", cpu_name, program_index);
+
+    return check_run(&run, name);
+}
+
+void print_help(void)
+{
+    puts("Usage: sim65-blockcheck [--programs=N] [--seed=S]");
+    puts("");
+    puts("Execute two self-modifying programs and random programs, that often store to themselves, with both");
+    puts("ExecuteInsn and RunBlocks, and report where RunBlocks ends up in a different state.");
+    puts("");
+    puts("  --programs=N  Number of random programs per CPU (default 1000).");
+    puts("  --seed=S      Seed of the random programs (default 0).");
+}
+
+int main(int argc, char ** argv)
+{
+    unsigned long long programs = 1000;
+    uint64_t seed = 0;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0)
+        {
+            print_help();
+            return EXIT_SUCCESS;
+        }
+        else if (strncmp(argv[i], "--programs=", 11) == 0 || strncmp(argv[i], "--seed=", 7) == 0)
+        {
+            bool is_seed = (argv[i][2] == 's');
+            const char * value_string = argv[i] + (is_seed ? 7 : 11);
+            char * endptr;
+            errno = 0;
+            unsigned long long value = strtoull(value_string, &endptr, 10);
+            if (*value_string == '\0' || *endptr != '\0' || errno != 0 || *value_string == '-')
+            {
+                printf("Bad %s: %s\n", is_seed ? "seed" : "number of programs", argv[i]);
+                return EXIT_FAILURE;
+            }
+            if (is_seed)
+            {
+                seed = value;
+            }
+            else
+            {
+                programs = value;
+            }
+        }
+        else
+        {
+            printf("Unknown option: %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // The state of xorshift64* must not be zero.
+    random_state = seed ^ 0x9e3779b97f4a7c15ULL;
+    random_state = (random_state != 0) ? random_state : 1;
+
+    static const CPUType cpu_types[3] = { CPU_6502, CPU_65C02, CPU_6502X };
+    static const char * const cpu_names[3] = { "6502", "65C02", "6502X" };
+
+    unsigned failure_count = 0;
+
+    for (unsigned cpu_index = 0; cpu_index < 3; ++cpu_index)
+    {
+        unsigned cpu_failure_count = 0;
+
+        if (!check_self_modifying_program(cpu_types[cpu_index], cpu_names[cpu_index], self_modifying_program_1, sizeof(self_modifying_program_1), 1))
+        {
+            ++cpu_failure_count;
+        }
+
+        if (!check_self_modifying_program(cpu_types[cpu_index], cpu_names[cpu_index], self_modifying_program_2, sizeof(self_modifying_program_2), 2))
+        {
+            ++cpu_failure_count;
+        }
+
+        for (unsigned long long program_index = 0; program_index < programs; ++program_index)
+        {
+            if (!check_random_program(cpu_types[cpu_index], cpu_names[cpu_index], program_index))
+            {
+                ++cpu_failure_count;
+            }
+        }
+
+        printf("%s: %u of %llu programs differ.\n", cpu_names[cpu_index], cpu_failure_count, programs + 2);
+
+        failure_count += cpu_failure_count;
+    }
+
+    return (failure_count == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
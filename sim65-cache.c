@@ -0,0 +1,175 @@
+
+///////////////////
+// sim65-cache.c //
+///////////////////
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sim65-cache.h"
+
+static uint64_t mix(uint64_t hash)
+{
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccd;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+uint64_t sim65_hash_bytes(uint64_t hash, const void * data, size_t size)
+{
+    const unsigned char * bytes = data;
+
+    // Process the data a word at a time; test case files are large.
+
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, bytes + i, 8);
+        hash = ((hash << 29) | (hash >> 35)) ^ word;
+        hash *= 0x9e3779b97f4a7c15;
+    }
+
+    for (; i < size; ++i)
+    {
+        hash = (hash ^ bytes[i]) * 0x100000001b3;
+    }
+
+    return mix(hash ^ size);
+}
+
+int sim65_hash_file(const char * filename, uint64_t * hash)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        return -1; // Cannot open file.
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return -1; // fstat() error.
+    }
+
+    if (!S_ISREG(st.st_mode))
+    {
+        close(fd);
+        return 1; // Not a regular file.
+    }
+
+    if (st.st_size == 0)
+    {
+        close(fd);
+        *hash = sim65_hash_bytes(SIM65_HASH_INITIAL, NULL, 0);
+        return 0;
+    }
+
+    void * mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (mapping == MAP_FAILED)
+    {
+        return -1; // mmap() error.
+    }
+
+    madvise(mapping, st.st_size, MADV_SEQUENTIAL);
+
+    *hash = sim65_hash_bytes(SIM65_HASH_INITIAL, mapping, st.st_size);
+
+    munmap(mapping, st.st_size);
+
+    return 0;
+}
+
+static char * cache_entry_filename(const char * cache_directory, uint64_t key, const char * suffix)
+{
+    size_t size = strlen(cache_directory) + 1 + 16 + strlen(suffix) + 1;
+
+    char * filename = malloc(size);
+    if (filename != NULL)
+    {
+        snprintf(filename, size, "%s/%016llx%s", cache_directory, (unsigned long long)key, suffix);
+    }
+    return filename;
+}
+
+FILE * sim65_cache_lookup(const char * cache_directory, uint64_t key)
+{
+    char * filename = cache_entry_filename(cache_directory, key, "");
+    if (filename == NULL)
+    {
+        return NULL; // malloc() error.
+    }
+
+    FILE * f = fopen(filename, "rb");
+
+    free(filename);
+
+    return f;
+}
+
+int sim65_cache_store(const char * cache_directory, uint64_t key, FILE * contents)
+{
+    if (mkdir(cache_directory, 0777) != 0 && errno != EEXIST)
+    {
+        return -1; // Cannot create the cache directory.
+    }
+
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".tmp%ld", (long)getpid());
+
+    char * temporary_filename = cache_entry_filename(cache_directory, key, suffix);
+    char * filename = cache_entry_filename(cache_directory, key, "");
+
+    if (temporary_filename == NULL || filename == NULL)
+    {
+        free(temporary_filename);
+        free(filename);
+        return -1; // malloc() error.
+    }
+
+    int result = -1;
+
+    FILE * f = fopen(temporary_filename, "wb");
+    if (f != NULL)
+    {
+        char buffer[0x10000];
+        size_t size;
+        bool write_error = false;
+
+        rewind(contents);
+        while (!write_error && (size = fread(buffer, 1, sizeof(buffer), contents)) != 0)
+        {
+            write_error = (fwrite(buffer, 1, size, f) != size);
+        }
+
+        write_error = write_error || ferror(contents);
+
+        if (fclose(f) == 0 && !write_error && rename(temporary_filename, filename) == 0)
+        {
+            result = 0;
+        }
+        else
+        {
+            remove(temporary_filename);
+        }
+    }
+
+    free(temporary_filename);
+    free(filename);
+
+    return result;
+}
@@ -0,0 +1,36 @@
+
+///////////////////
+// sim65-cache.h //
+///////////////////
+
+// A persistent cache of test results.
+//
+// The output that sim65-test produces for a test case file is fully determined by the contents and name of the
+// file, the CPU mode, the test flags, and the simulator itself. Each cache entry is a file in the cache directory,
+// named after a hash of all of these, that holds the output of an earlier run. A rerun of unchanged test case
+// files against an unchanged simulator can simply replay these outputs.
+
+#ifndef SIM65_CACHE_H
+#define SIM65_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define SIM65_HASH_INITIAL 0xcbf29ce484222325
+
+// Combine a hash value with the given bytes. This is a fast, non-cryptographic hash.
+uint64_t sim65_hash_bytes(uint64_t hash, const void * data, size_t size);
+
+// Hash the contents of a file.
+// Returns 0 on success, 1 if the file is not a regular file, and -1 on error.
+int sim65_hash_file(const char * filename, uint64_t * hash);
+
+// Open the cache entry with the given key for reading. Returns NULL if there is no such entry.
+FILE * sim65_cache_lookup(const char * cache_directory, uint64_t key);
+
+// Store the contents of a file as the cache entry with the given key.
+// The entry is written under a temporary name and renamed, so concurrent readers never see a partial entry.
+int sim65_cache_store(const char * cache_directory, uint64_t key, FILE * contents);
+
+#endif
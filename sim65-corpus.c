@@ -0,0 +1,292 @@
+
+////////////////////
+// sim65-corpus.c //
+////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sim65-corpus.h"
+
+// The records are accessed directly in the mapped file, so their layout must not depend on the compiler.
+_Static_assert(sizeof(struct sim65_corpus_header_type) == 24, "unexpected header size");
+_Static_assert(sizeof(struct sim65_corpus_registers_type) == 8, "unexpected register record size");
+_Static_assert(sizeof(struct sim65_corpus_testcase_type) == 36, "unexpected testcase record size");
+_Static_assert(sizeof(struct ram_assignment_type) == 4, "unexpected RAM assignment record size");
+_Static_assert(sizeof(struct bus_access_type) == 4, "unexpected bus access record size");
+
+int sim65_corpus_map(const char * filename, struct sim65_corpus_type * corpus)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        return -1; // Cannot open file.
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return -1; // fstat() error.
+    }
+
+    if (!S_ISREG(st.st_mode) || (size_t)st.st_size < sizeof(struct sim65_corpus_header_type))
+    {
+        close(fd);
+        return 1; // Not a binary test case file.
+    }
+
+    uint32_t magic;
+    if (pread(fd, &magic, sizeof(magic), 0) != sizeof(magic))
+    {
+        close(fd);
+        return -1; // pread() error.
+    }
+
+    if (magic != SIM65_CORPUS_MAGIC)
+    {
+        close(fd);
+        return 1; // Not a binary test case file.
+    }
+
+    size_t mapping_size = st.st_size;
+    void * mapping = mmap(NULL, mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (mapping == MAP_FAILED)
+    {
+        return -1; // mmap() error.
+    }
+
+    const struct sim65_corpus_header_type * header = mapping;
+
+    // Verify that the sections described by the header fit in the file.
+
+    size_t testcases_offset = sizeof(struct sim65_corpus_header_type);
+    size_t ram_assignments_offset = testcases_offset + (size_t)header->testcase_count * sizeof(struct sim65_corpus_testcase_type);
+    size_t bus_accesses_offset = ram_assignments_offset + (size_t)header->ram_assignment_count * sizeof(struct ram_assignment_type);
+    size_t names_offset = bus_accesses_offset + (size_t)header->bus_access_count * sizeof(struct bus_access_type);
+
+    if (header->version != SIM65_CORPUS_VERSION || names_offset + header->names_size != mapping_size)
+    {
+        munmap(mapping, mapping_size);
+        return -1; // Unsupported version or corrupt file.
+    }
+
+    corpus->mapping = mapping;
+    corpus->mapping_size = mapping_size;
+    corpus->header = header;
+    corpus->testcases = (const struct sim65_corpus_testcase_type *)((const char *)mapping + testcases_offset);
+    corpus->ram_assignments = (const struct ram_assignment_type *)((const char *)mapping + ram_assignments_offset);
+    corpus->bus_accesses = (const struct bus_access_type *)((const char *)mapping + bus_accesses_offset);
+    corpus->names = (const char *)mapping + names_offset;
+
+    // Verify that all test cases refer to data inside the file, so users of the corpus don't have to.
+
+    for (uint32_t i = 0; i < header->testcase_count; ++i)
+    {
+        const struct sim65_corpus_testcase_type * testcase = &corpus->testcases[i];
+        if ((size_t)testcase->ram_index + testcase->initial_ram_count + testcase->final_ram_count > header->ram_assignment_count ||
+            (size_t)testcase->bus_index + testcase->cycles > header->bus_access_count ||
+            testcase->name_offset >= header->names_size ||
+            memchr(corpus->names + testcase->name_offset, '\0', header->names_size - testcase->name_offset) == NULL)
+        {
+            munmap(mapping, mapping_size);
+            return -1; // Corrupt file.
+        }
+    }
+
+    return 0;
+}
+
+void sim65_corpus_unmap(struct sim65_corpus_type * corpus)
+{
+    munmap(corpus->mapping, corpus->mapping_size);
+    corpus->mapping = NULL;
+}
+
+bool sim65_corpus_is_outdated(const char * filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct sim65_corpus_header_type header;
+    bool outdated = pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+                    header.magic == SIM65_CORPUS_MAGIC && header.version != SIM65_CORPUS_VERSION;
+
+    close(fd);
+    return outdated;
+}
+
+void sim65_corpus_writer_init(struct sim65_corpus_writer_type * writer)
+{
+    memset(writer, 0, sizeof(*writer));
+}
+
+void sim65_corpus_writer_free(struct sim65_corpus_writer_type * writer)
+{
+    free(writer->testcases);
+    free(writer->ram_assignments);
+    free(writer->bus_accesses);
+    free(writer->names);
+    sim65_corpus_writer_init(writer);
+}
+
+static int grow_array(void ** array, size_t * capacity, size_t required, size_t element_size)
+{
+    if (required <= *capacity)
+    {
+        return 0;
+    }
+
+    size_t new_capacity = (*capacity == 0) ? 1024 : *capacity;
+    while (new_capacity < required)
+    {
+        new_capacity *= 2;
+    }
+
+    void * new_array = realloc(*array, new_capacity * element_size);
+    if (new_array == NULL)
+    {
+        return -1; // realloc() error.
+    }
+
+    *array = new_array;
+    *capacity = new_capacity;
+    return 0;
+}
+
+int sim65_corpus_writer_add_testcase(struct sim65_corpus_writer_type * writer, const char * name, unsigned cycles,
+                                     const struct sim65_corpus_registers_type * initial_registers,
+                                     const struct sim65_corpus_registers_type * final_registers)
+{
+    size_t name_size = strlen(name) + 1;
+
+    if (writer->testcase_count == UINT32_MAX || cycles > UINT16_MAX || writer->names_size + name_size > UINT32_MAX ||
+        writer->bus_access_count + cycles > UINT32_MAX)
+    {
+        return -1; // Cannot be represented.
+    }
+
+    if (grow_array((void **)&writer->testcases, &writer->testcase_capacity, writer->testcase_count + 1, sizeof(struct sim65_corpus_testcase_type)) != 0 ||
+        grow_array((void **)&writer->names, &writer->names_capacity, writer->names_size + name_size, 1) != 0)
+    {
+        return -1;
+    }
+
+    struct sim65_corpus_testcase_type * testcase = &writer->testcases[writer->testcase_count++];
+
+    memset(testcase, 0, sizeof(*testcase));
+    testcase->initial_registers = *initial_registers;
+    testcase->final_registers = *final_registers;
+    testcase->name_offset = writer->names_size;
+    testcase->ram_index = writer->ram_assignment_count;
+    testcase->cycles = cycles;
+    testcase->bus_index = writer->bus_access_count;
+
+    memcpy(writer->names + writer->names_size, name, name_size);
+    writer->names_size += name_size;
+
+    return 0;
+}
+
+int sim65_corpus_writer_add_ram_assignment(struct sim65_corpus_writer_type * writer, bool is_final, uint16_t address, uint8_t value)
+{
+    if (writer->testcase_count == 0)
+    {
+        return -1; // No test case to add the assignment to.
+    }
+
+    struct sim65_corpus_testcase_type * testcase = &writer->testcases[writer->testcase_count - 1];
+
+    uint16_t * count = is_final ? &testcase->final_ram_count : &testcase->initial_ram_count;
+
+    if (*count == UINT16_MAX || writer->ram_assignment_count == UINT32_MAX || (!is_final && testcase->final_ram_count != 0))
+    {
+        return -1; // Cannot be represented.
+    }
+
+    if (grow_array((void **)&writer->ram_assignments, &writer->ram_assignment_capacity, writer->ram_assignment_count + 1, sizeof(struct ram_assignment_type)) != 0)
+    {
+        return -1;
+    }
+
+    struct ram_assignment_type * assignment = &writer->ram_assignments[writer->ram_assignment_count++];
+
+    memset(assignment, 0, sizeof(*assignment)); // Don't write uninitialized padding to the file.
+    assignment->address = address;
+    assignment->value = value;
+
+    ++*count;
+
+    return 0;
+}
+
+int sim65_corpus_writer_add_bus_access(struct sim65_corpus_writer_type * writer, const struct bus_access_type * access)
+{
+    if (writer->testcase_count == 0)
+    {
+        return -1; // No test case to add the access to.
+    }
+
+    const struct sim65_corpus_testcase_type * testcase = &writer->testcases[writer->testcase_count - 1];
+
+    if (writer->bus_access_count == testcase->bus_index + testcase->cycles)
+    {
+        return -1; // The test case has no more cycles.
+    }
+
+    if (grow_array((void **)&writer->bus_accesses, &writer->bus_access_capacity, writer->bus_access_count + 1, sizeof(struct bus_access_type)) != 0)
+    {
+        return -1;
+    }
+
+    writer->bus_accesses[writer->bus_access_count++] = *access;
+
+    return 0;
+}
+
+int sim65_corpus_writer_write(struct sim65_corpus_writer_type * writer, const char * filename)
+{
+    struct sim65_corpus_header_type header;
+
+    memset(&header, 0, sizeof(header));
+    header.magic = SIM65_CORPUS_MAGIC;
+    header.version = SIM65_CORPUS_VERSION;
+    header.testcase_count = writer->testcase_count;
+    header.ram_assignment_count = writer->ram_assignment_count;
+    header.names_size = writer->names_size;
+    header.bus_access_count = writer->bus_access_count;
+
+    FILE * f = fopen(filename, "wb");
+    if (f == NULL)
+    {
+        return -1; // Cannot open file.
+    }
+
+    if (fwrite(&header, sizeof(header), 1, f) != 1 ||
+        fwrite(writer->testcases, sizeof(struct sim65_corpus_testcase_type), writer->testcase_count, f) != writer->testcase_count ||
+        fwrite(writer->ram_assignments, sizeof(struct ram_assignment_type), writer->ram_assignment_count, f) != writer->ram_assignment_count ||
+        fwrite(writer->bus_accesses, sizeof(struct bus_access_type), writer->bus_access_count, f) != writer->bus_access_count ||
+        fwrite(writer->names, 1, writer->names_size, f) != writer->names_size)
+    {
+        fclose(f);
+        return -1; // fwrite() error.
+    }
+
+    if (fclose(f) != 0)
+    {
+        return -1; // fclose() error.
+    }
+
+    return 0;
+}
@@ -0,0 +1,132 @@
+
+////////////////////
+// sim65-corpus.h //
+////////////////////
+
+// A compact binary representation of a 65x02 test case file.
+//
+// Converting the JSON test case files to this format once allows sim65-test to map them into memory and
+// iterate over the test cases without any parsing. The file is laid out as follows:
+//
+//   struct sim65_corpus_header_type     header;
+//   struct sim65_corpus_testcase_type   testcases[header.testcase_count];
+//   struct ram_assignment_type          ram_assignments[header.ram_assignment_count];
+//   struct bus_access_type              bus_accesses[header.bus_access_count];
+//   char                                names[header.names_size];
+//
+// Each test case refers to a contiguous range of RAM assignments (first those of the initial state, followed
+// by those of the final state), to a contiguous range of bus accesses (one for each cycle), and to a
+// zero-terminated name in the name table. The RAM assignments and bus accesses are stored as
+// 'struct ram_assignment_type' and 'struct bus_access_type', so test case specifications can point directly
+// into the file.
+//
+// All values are stored in the byte order of the machine that wrote the file; a file written on a machine
+// with a different byte order is rejected because its magic number does not match.
+
+#ifndef SIM65_CORPUS_H
+#define SIM65_CORPUS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sim65-testcase.h"
+
+#define SIM65_CORPUS_MAGIC    0x54353653 // "S65T" when stored little-endian.
+#define SIM65_CORPUS_VERSION  2
+
+struct sim65_corpus_header_type
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t testcase_count;
+    uint32_t ram_assignment_count;
+    uint32_t names_size;
+    uint32_t bus_access_count;
+};
+
+struct sim65_corpus_registers_type
+{
+    uint16_t pc;
+    uint8_t s;
+    uint8_t a;
+    uint8_t x;
+    uint8_t y;
+    uint8_t p;
+    uint8_t reserved;
+};
+
+struct sim65_corpus_testcase_type
+{
+    struct sim65_corpus_registers_type initial_registers;
+    struct sim65_corpus_registers_type final_registers;
+    uint32_t name_offset;        // Offset of the test case name in the name table.
+    uint32_t ram_index;          // Index of the first initial-state RAM assignment.
+    uint16_t initial_ram_count;
+    uint16_t final_ram_count;
+    uint16_t cycles;             // Number of cycles, and of bus accesses.
+    uint16_t reserved;
+    uint32_t bus_index;          // Index of the bus access of the first cycle.
+};
+
+// A test case file that has been mapped into memory.
+
+struct sim65_corpus_type
+{
+    void * mapping;
+    size_t mapping_size;
+    const struct sim65_corpus_header_type * header;
+    const struct sim65_corpus_testcase_type * testcases;
+    const struct ram_assignment_type * ram_assignments;
+    const struct bus_access_type * bus_accesses;
+    const char * names;
+};
+
+// Map a binary test case file into memory.
+// Returns 0 on success, 1 if the file is not a binary test case file, and -1 on error.
+int sim65_corpus_map(const char * filename, struct sim65_corpus_type * corpus);
+
+void sim65_corpus_unmap(struct sim65_corpus_type * corpus);
+
+// Check if a file is a binary test case file of another version, which sim65_corpus_map() rejects.
+bool sim65_corpus_is_outdated(const char * filename);
+
+// Accumulates test cases in memory, to be written as a binary test case file.
+
+struct sim65_corpus_writer_type
+{
+    struct sim65_corpus_testcase_type * testcases;
+    size_t testcase_count;
+    size_t testcase_capacity;
+    struct ram_assignment_type * ram_assignments;
+    size_t ram_assignment_count;
+    size_t ram_assignment_capacity;
+    struct bus_access_type * bus_accesses;
+    size_t bus_access_count;
+    size_t bus_access_capacity;
+    char * names;
+    size_t names_size;
+    size_t names_capacity;
+};
+
+void sim65_corpus_writer_init(struct sim65_corpus_writer_type * writer);
+
+void sim65_corpus_writer_free(struct sim65_corpus_writer_type * writer);
+
+// Add a test case. The RAM assignments of the initial and final state and the bus accesses of its cycles are
+// added separately, after the test case itself, using sim65_corpus_writer_add_ram_assignment() and
+// sim65_corpus_writer_add_bus_access().
+int sim65_corpus_writer_add_testcase(struct sim65_corpus_writer_type * writer, const char * name, unsigned cycles,
+                                     const struct sim65_corpus_registers_type * initial_registers,
+                                     const struct sim65_corpus_registers_type * final_registers);
+
+// Add a RAM assignment to the initial or final state of the most recently added test case.
+// All initial-state assignments must be added before the first final-state assignment.
+int sim65_corpus_writer_add_ram_assignment(struct sim65_corpus_writer_type * writer, bool is_final, uint16_t address, uint8_t value);
+
+// Add the bus access of the next cycle of the most recently added test case.
+int sim65_corpus_writer_add_bus_access(struct sim65_corpus_writer_type * writer, const struct bus_access_type * access);
+
+int sim65_corpus_writer_write(struct sim65_corpus_writer_type * writer, const char * filename);
+
+#endif
@@ -0,0 +1,564 @@
+
+/////////////////////////
+// sim65-fingerprint.c //
+/////////////////////////
+
+// Build tool that computes a fingerprint of the machine code of each opcode handler of the simulator.
+//
+// Usage: sim65-fingerprint OBJECT... [--group NAME FILE...]... > sim65-fingerprints.h
+//
+// The objects are the relocatable object files of the simulator core (6502.o, memory.o, peripherals.o), compiled
+// with -ffunction-sections and -fdata-sections. The handler of each opcode is found through the relocations of the
+// opcode tables in 6502.o. Its fingerprint is a hash of:
+//
+// - the code bytes of the handler function;
+// - the relocations that apply to it. In an object file, the bytes of a reference to another symbol are not yet
+//   filled in, so the fingerprint of a handler does not change when unrelated code moves;
+// - for each function called by the handler, that function's own fingerprint, so changes to helper functions
+//   are taken into account;
+// - for each data object referenced by the handler, its initial contents.
+//
+// The output is a C header that defines the array 'sim65_handler_fingerprints[3][256]', indexed by
+// 'enum sim65_cpu_mode_type' and opcode. It also defines 'sim65_core_fingerprint', which combines the fingerprints
+// of all global functions of the objects: the entry points that the test harness calls, such as Reset() and
+// ExecuteInsn(). If the objects cannot be analyzed (e.g., they are not 64-bit ELF files), all of these
+// fingerprints are zero, which sim65-test interprets as "unknown".
+//
+// Each '--group NAME FILE...' defines 'sim65_NAME_fingerprint' as a hash of the contents of the files. This works
+// for files of any kind.
+
+#include <elf.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim65-cache.h"
+
+// The opcode tables in 6502.c, in the order of 'enum sim65_cpu_mode_type'.
+static const char * const opcode_table_names[3] = { "OP6502Table", "OP65C02Table", "OP6502XTable" };
+
+enum fingerprint_state_type
+{
+    FINGERPRINT_UNKNOWN,
+    FINGERPRINT_IN_PROGRESS,
+    FINGERPRINT_DONE
+};
+
+struct object_file_type
+{
+    const char * filename;
+    unsigned char * data;
+    size_t size;
+    const Elf64_Ehdr * header;
+    const Elf64_Shdr * sections;
+    const Elf64_Sym * symbols;
+    size_t symbol_count;
+    const char * symbol_names;
+    const char * section_names;
+    enum fingerprint_state_type * states;   // Per symbol.
+    uint64_t * fingerprints;                // Per symbol.
+};
+
+static struct object_file_type * objects;
+static unsigned object_count;
+
+static bool in_bounds(const struct object_file_type * object, uint64_t offset, uint64_t size)
+{
+    return offset <= object->size && size <= object->size - offset;
+}
+
+static int load_object_file(const char * filename, struct object_file_type * object)
+{
+    memset(object, 0, sizeof(*object));
+    object->filename = filename;
+
+    FILE * f = fopen(filename, "rb");
+    if (f == NULL)
+    {
+        return -1; // Cannot open file.
+    }
+
+    if (fseek(f, 0, SEEK_END) != 0 || (long)(object->size = ftell(f)) < 0 || fseek(f, 0, SEEK_SET) != 0)
+    {
+        fclose(f);
+        return -1;
+    }
+
+    object->data = malloc(object->size + 1);
+    if (object->data == NULL || fread(object->data, 1, object->size, f) != object->size)
+    {
+        fclose(f);
+        return -1;
+    }
+
+    fclose(f);
+
+    // We only support 64-bit relocatable ELF files in the byte order of the machine we run on.
+
+    const Elf64_Ehdr * header = (const Elf64_Ehdr *)object->data;
+
+    if (object->size < sizeof(Elf64_Ehdr) || memcmp(header->e_ident, ELFMAG, SELFMAG) != 0 ||
+        header->e_ident[EI_CLASS] != ELFCLASS64 || header->e_type != ET_REL ||
+        header->e_shentsize != sizeof(Elf64_Shdr) || !in_bounds(object, header->e_shoff, (uint64_t)header->e_shnum * sizeof(Elf64_Shdr)) ||
+        header->e_shstrndx >= header->e_shnum)
+    {
+        return -1; // Unsupported file.
+    }
+
+    object->header = header;
+    object->sections = (const Elf64_Shdr *)(object->data + header->e_shoff);
+
+    for (unsigned i = 0; i < header->e_shnum; ++i)
+    {
+        const Elf64_Shdr * section = &object->sections[i];
+        if (section->sh_type != SHT_NOBITS && !in_bounds(object, section->sh_offset, section->sh_size))
+        {
+            return -1; // Corrupt file.
+        }
+        if (section->sh_type == SHT_SYMTAB)
+        {
+            if (section->sh_link >= header->e_shnum || section->sh_entsize != sizeof(Elf64_Sym))
+            {
+                return -1; // Corrupt file.
+            }
+            object->symbols = (const Elf64_Sym *)(object->data + section->sh_offset);
+            object->symbol_count = section->sh_size / sizeof(Elf64_Sym);
+            object->symbol_names = (const char *)object->data + object->sections[section->sh_link].sh_offset;
+        }
+    }
+
+    if (object->symbols == NULL)
+    {
+        return -1; // No symbol table.
+    }
+
+    object->section_names = (const char *)object->data + object->sections[header->e_shstrndx].sh_offset;
+
+    // The file buffer has one extra byte, so the last string table is always terminated.
+    object->data[object->size] = '\0';
+
+    object->states = calloc(object->symbol_count, sizeof(enum fingerprint_state_type));
+    object->fingerprints = calloc(object->symbol_count, sizeof(uint64_t));
+    if (object->states == NULL || object->fingerprints == NULL)
+    {
+        return -1; // calloc() error.
+    }
+
+    return 0;
+}
+
+static const char * symbol_name(const struct object_file_type * object, const Elf64_Sym * symbol)
+{
+    if (ELF64_ST_TYPE(symbol->st_info) == STT_SECTION && symbol->st_shndx < object->header->e_shnum)
+    {
+        return object->section_names + object->sections[symbol->st_shndx].sh_name;
+    }
+    return object->symbol_names + symbol->st_name;
+}
+
+static bool is_defined(const Elf64_Sym * symbol)
+{
+    return symbol->st_shndx != SHN_UNDEF && symbol->st_shndx < SHN_LORESERVE;
+}
+
+// Find a symbol of the given type that is defined in one of the objects. Local symbols are only found in the
+// object that refers to them; global symbols are found in any object.
+static bool find_symbol(const struct object_file_type * referrer, const char * name, unsigned type,
+                        struct object_file_type ** found_object, size_t * found_index)
+{
+    for (unsigned i = 0; i < object_count; ++i)
+    {
+        struct object_file_type * object = &objects[i];
+        for (size_t j = 1; j < object->symbol_count; ++j)
+        {
+            const Elf64_Sym * symbol = &object->symbols[j];
+            if (ELF64_ST_TYPE(symbol->st_info) == type && is_defined(symbol) &&
+                (object == referrer || ELF64_ST_BIND(symbol->st_info) != STB_LOCAL) &&
+                strcmp(object->symbol_names + symbol->st_name, name) == 0)
+            {
+                *found_object = object;
+                *found_index = j;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Find the function or data object that starts at the given offset in a section.
+static bool find_symbol_at(struct object_file_type * object, unsigned section_index, uint64_t offset, size_t * found_index)
+{
+    for (size_t j = 1; j < object->symbol_count; ++j)
+    {
+        const Elf64_Sym * symbol = &object->symbols[j];
+        unsigned type = ELF64_ST_TYPE(symbol->st_info);
+        if ((type == STT_FUNC || type == STT_OBJECT) && symbol->st_shndx == section_index && symbol->st_value == offset)
+        {
+            *found_index = j;
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint64_t hash_value(uint64_t hash, uint64_t value)
+{
+    return sim65_hash_bytes(hash, &value, sizeof(value));
+}
+
+static uint64_t hash_string(uint64_t hash, const char * s)
+{
+    return sim65_hash_bytes(hash, s, strlen(s) + 1);
+}
+
+static uint64_t function_fingerprint(struct object_file_type * object, size_t symbol_index);
+
+// Hash a function or data object that is defined in one of the objects: the fingerprint of a function,
+// or the initial contents of a data object.
+static uint64_t hash_defined_symbol(uint64_t hash, struct object_file_type * object, size_t symbol_index)
+{
+    const Elf64_Sym * symbol = &object->symbols[symbol_index];
+
+    if (ELF64_ST_TYPE(symbol->st_info) == STT_FUNC)
+    {
+        return hash_value(hash, function_fingerprint(object, symbol_index));
+    }
+
+    const Elf64_Shdr * section = &object->sections[symbol->st_shndx];
+    if (section->sh_type == SHT_PROGBITS && symbol->st_value + symbol->st_size <= section->sh_size)
+    {
+        hash = sim65_hash_bytes(hash, object->data + section->sh_offset + symbol->st_value, symbol->st_size);
+    }
+
+    return hash;
+}
+
+// Hash the identity, and where possible the contents, of the target of a relocation.
+static uint64_t hash_relocation_target(uint64_t hash, struct object_file_type * object, const Elf64_Rela * relocation)
+{
+    size_t symbol_index = ELF64_R_SYM(relocation->r_info);
+    int64_t addend = relocation->r_addend;
+
+    if (symbol_index == 0 || symbol_index >= object->symbol_count)
+    {
+        return hash_value(hash, addend);
+    }
+
+    const Elf64_Sym * symbol = &object->symbols[symbol_index];
+
+    if (ELF64_ST_TYPE(symbol->st_info) == STT_SECTION && symbol->st_shndx < object->header->e_shnum)
+    {
+        // A reference to a section plus an offset is resolved to the function or data object at that offset.
+        // For references from code, the addend may include a small negative bias (-4 for PC-relative references
+        // on x86-64), so we also look for a symbol at the addend corrected for that bias.
+
+        size_t target_index;
+        if (find_symbol_at(object, symbol->st_shndx, addend, &target_index) ||
+            find_symbol_at(object, symbol->st_shndx, addend + 4, &target_index))
+        {
+            const Elf64_Sym * target = &object->symbols[target_index];
+            hash = hash_string(hash, symbol_name(object, target));
+            hash = hash_value(hash, addend - (int64_t)target->st_value);
+            return hash_defined_symbol(hash, object, target_index);
+        }
+
+        const Elf64_Shdr * section = &object->sections[symbol->st_shndx];
+
+        hash = hash_string(hash, symbol_name(object, symbol));
+        hash = hash_value(hash, addend);
+
+        if (section->sh_type == SHT_PROGBITS && (section->sh_flags & SHF_STRINGS) && addend >= 0 && (uint64_t)addend < section->sh_size)
+        {
+            // A string literal.
+            const char * s = (const char *)object->data + section->sh_offset + addend;
+            return sim65_hash_bytes(hash, s, strnlen(s, section->sh_size - addend));
+        }
+
+        if (section->sh_type == SHT_PROGBITS && !(section->sh_flags & SHF_EXECINSTR))
+        {
+            // Anonymous data, such as a jump table. Its own relocations are not followed.
+            return sim65_hash_bytes(hash, object->data + section->sh_offset, section->sh_size);
+        }
+
+        return hash;
+    }
+
+    // A reference to a named symbol. Undefined symbols are looked up in the other objects.
+
+    const char * name = object->symbol_names + symbol->st_name;
+
+    hash = hash_string(hash, name);
+    hash = hash_value(hash, addend);
+
+    struct object_file_type * target_object = object;
+    size_t target_index = symbol_index;
+
+    if (!is_defined(symbol) &&
+        !find_symbol(object, name, STT_FUNC, &target_object, &target_index) &&
+        !find_symbol(object, name, STT_OBJECT, &target_object, &target_index))
+    {
+        return hash; // Defined outside the simulator core, e.g. in the C library or in sim65-test.
+    }
+
+    unsigned target_type = ELF64_ST_TYPE(target_object->symbols[target_index].st_info);
+    if (target_type != STT_FUNC && target_type != STT_OBJECT)
+    {
+        return hash; // E.g., thread-local variables, which have no initial contents worth hashing.
+    }
+
+    return hash_defined_symbol(hash, target_object, target_index);
+}
+
+static uint64_t function_fingerprint(struct object_file_type * object, size_t symbol_index)
+{
+    if (object->states[symbol_index] == FINGERPRINT_DONE)
+    {
+        return object->fingerprints[symbol_index];
+    }
+
+    const Elf64_Sym * symbol = &object->symbols[symbol_index];
+    const char * name = object->symbol_names + symbol->st_name;
+
+    if (object->states[symbol_index] == FINGERPRINT_IN_PROGRESS)
+    {
+        // Recursion; the function is identified by its name only.
+        return hash_string(SIM65_HASH_INITIAL, name);
+    }
+
+    object->states[symbol_index] = FINGERPRINT_IN_PROGRESS;
+
+    uint64_t hash = hash_string(SIM65_HASH_INITIAL, name);
+
+    const Elf64_Shdr * section = &object->sections[symbol->st_shndx];
+
+    if (section->sh_type == SHT_PROGBITS && symbol->st_value + symbol->st_size <= section->sh_size)
+    {
+        hash = sim65_hash_bytes(hash, object->data + section->sh_offset + symbol->st_value, symbol->st_size);
+    }
+
+    // Hash the relocations that apply to the code of the function.
+
+    for (unsigned i = 0; i < object->header->e_shnum; ++i)
+    {
+        const Elf64_Shdr * rela_section = &object->sections[i];
+
+        if (rela_section->sh_type != SHT_RELA || rela_section->sh_info != symbol->st_shndx || rela_section->sh_entsize != sizeof(Elf64_Rela))
+        {
+            continue;
+        }
+
+        const Elf64_Rela * relocations = (const Elf64_Rela *)(object->data + rela_section->sh_offset);
+        size_t relocation_count = rela_section->sh_size / sizeof(Elf64_Rela);
+
+        for (size_t j = 0; j < relocation_count; ++j)
+        {
+            const Elf64_Rela * relocation = &relocations[j];
+            if (relocation->r_offset >= symbol->st_value && relocation->r_offset < symbol->st_value + symbol->st_size)
+            {
+                hash = hash_value(hash, relocation->r_offset - symbol->st_value);
+                hash = hash_value(hash, ELF64_R_TYPE(relocation->r_info));
+                hash = hash_relocation_target(hash, object, relocation);
+            }
+        }
+    }
+
+    object->states[symbol_index] = FINGERPRINT_DONE;
+    object->fingerprints[symbol_index] = hash;
+
+    return hash;
+}
+
+// Compute the fingerprints of the handlers in an opcode table. Returns 0 on success, -1 if the table is not found.
+static int opcode_table_fingerprints(const char * table_name, uint64_t fingerprints[256])
+{
+    struct object_file_type * object = NULL;
+    size_t table_index;
+
+    // The tables are static, so they are local symbols of the object that defines them.
+
+    for (unsigned i = 0; i < object_count && object == NULL; ++i)
+    {
+        if (!find_symbol(&objects[i], table_name, STT_OBJECT, &object, &table_index))
+        {
+            object = NULL;
+        }
+    }
+
+    if (object == NULL)
+    {
+        return -1;
+    }
+
+    const Elf64_Sym * table = &object->symbols[table_index];
+
+    for (unsigned i = 0; i < object->header->e_shnum; ++i)
+    {
+        const Elf64_Shdr * rela_section = &object->sections[i];
+
+        if (rela_section->sh_type != SHT_RELA || rela_section->sh_info != table->st_shndx || rela_section->sh_entsize != sizeof(Elf64_Rela))
+        {
+            continue;
+        }
+
+        const Elf64_Rela * relocations = (const Elf64_Rela *)(object->data + rela_section->sh_offset);
+        size_t relocation_count = rela_section->sh_size / sizeof(Elf64_Rela);
+
+        for (size_t j = 0; j < relocation_count; ++j)
+        {
+            const Elf64_Rela * relocation = &relocations[j];
+
+            if (relocation->r_offset < table->st_value || relocation->r_offset >= table->st_value + table->st_size)
+            {
+                continue;
+            }
+
+            uint64_t slot = (relocation->r_offset - table->st_value) / sizeof(uint64_t);
+            if (slot < 256)
+            {
+                fingerprints[slot] = hash_relocation_target(SIM65_HASH_INITIAL, object, relocation);
+            }
+        }
+    }
+
+    return 0;
+}
+
+// Combine the fingerprints of the global functions of all objects.
+static uint64_t global_functions_fingerprint(void)
+{
+    uint64_t hash = SIM65_HASH_INITIAL;
+
+    for (unsigned i = 0; i < object_count; ++i)
+    {
+        struct object_file_type * object = &objects[i];
+        for (size_t j = 1; j < object->symbol_count; ++j)
+        {
+            const Elf64_Sym * symbol = &object->symbols[j];
+            if (ELF64_ST_TYPE(symbol->st_info) == STT_FUNC && ELF64_ST_BIND(symbol->st_info) == STB_GLOBAL && is_defined(symbol))
+            {
+                hash = hash_value(hash, function_fingerprint(object, j));
+            }
+        }
+    }
+
+    return hash;
+}
+
+// Hash the contents of a group of files. Returns -1 if a file cannot be hashed.
+static int files_fingerprint(char ** filenames, unsigned count, uint64_t * fingerprint)
+{
+    uint64_t hash = SIM65_HASH_INITIAL;
+
+    for (unsigned i = 0; i < count; ++i)
+    {
+        uint64_t file_hash;
+        if (sim65_hash_file(filenames[i], &file_hash) != 0)
+        {
+            fprintf(stderr, "sim65-fingerprint: cannot read file '%s'.\n", filenames[i]);
+            return -1;
+        }
+        hash = hash_string(hash_value(hash, file_hash), filenames[i]);
+    }
+
+    *fingerprint = hash;
+    return 0;
+}
+
+int main(int argc, char ** argv)
+{
+    static uint64_t fingerprints[3][256];
+    uint64_t core_fingerprint = 0;
+
+    // The objects are the arguments up to the first group.
+
+    object_count = 0;
+    while (object_count + 1 < (unsigned)argc && strcmp(argv[object_count + 1], "--group") != 0)
+    {
+        ++object_count;
+    }
+
+    objects = calloc(object_count + 1, sizeof(struct object_file_type));
+    if (objects == NULL)
+    {
+        return EXIT_FAILURE;
+    }
+
+    bool supported = (object_count != 0);
+
+    for (unsigned i = 0; i < object_count && supported; ++i)
+    {
+        if (load_object_file(argv[i + 1], &objects[i]) != 0)
+        {
+            fprintf(stderr, "sim65-fingerprint: cannot analyze object file '%s'; handler fingerprints are not available.\n", argv[i + 1]);
+            supported = false;
+        }
+    }
+
+    for (unsigned i = 0; i < 3 && supported; ++i)
+    {
+        if (opcode_table_fingerprints(opcode_table_names[i], fingerprints[i]) != 0)
+        {
+            fprintf(stderr, "sim65-fingerprint: opcode table '%s' not found; handler fingerprints are not available.\n", opcode_table_names[i]);
+            supported = false;
+        }
+    }
+
+    if (supported)
+    {
+        core_fingerprint = global_functions_fingerprint();
+    }
+    else
+    {
+        memset(fingerprints, 0, sizeof(fingerprints));
+    }
+
+    printf("\n");
+    printf("// Generated by sim65-fingerprint; do not edit.\n");
+    printf("\n");
+    printf("static const uint64_t sim65_handler_fingerprints[3][256] = {\n");
+    for (unsigned i = 0; i < 3; ++i)
+    {
+        printf("    { // %s\n", opcode_table_names[i]);
+        for (unsigned j = 0; j < 256; ++j)
+        {
+            printf("%s0x%016llx%s", (j % 4 == 0) ? "        " : "", (unsigned long long)fingerprints[i][j], (j % 4 == 3) ? ",\n" : ", ");
+        }
+        printf("    }%s\n", (i < 2) ? "," : "");
+    }
+    printf("};\n");
+    printf("\n");
+    printf("static const uint64_t sim65_core_fingerprint = 0x%016llx;\n", (unsigned long long)core_fingerprint);
+
+    // The groups of files.
+
+    unsigned i = object_count + 1;
+    while (i < (unsigned)argc)
+    {
+        if (i + 1 >= (unsigned)argc)
+        {
+            fprintf(stderr, "sim65-fingerprint: '--group' without a name.\n");
+            return EXIT_FAILURE;
+        }
+
+        const char * name = argv[i + 1];
+        unsigned first = i + 2;
+
+        i = first;
+        while (i < (unsigned)argc && strcmp(argv[i], "--group") != 0)
+        {
+            ++i;
+        }
+
+        uint64_t group_fingerprint;
+        if (files_fingerprint(&argv[first], i - first, &group_fingerprint) != 0)
+        {
+            return EXIT_FAILURE;
+        }
+
+        printf("static const uint64_t sim65_%s_fingerprint = 0x%016llx;\n", name, (unsigned long long)group_fingerprint);
+    }
+
+    return EXIT_SUCCESS;
+}
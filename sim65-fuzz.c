@@ -0,0 +1,934 @@
+
+//////////////////
+// sim65-fuzz.c //
+//////////////////
+
+// Coverage-guided fuzzer for ExecuteInsn.
+//
+// Usage: sim65-fuzz [--cpu-mode=<mode>] [--opcode=XX] [--iterations=N] [--seed=S] [--output-dir=DIR]
+//
+// The 65x02 test suite has 10,000 random initial states per opcode, which rarely hit the corners of an instruction:
+// decimal mode ADC/SBC with invalid BCD operands, branches that cross a page, the JMP-indirect page bug. sim65-fuzz
+// keeps a corpus of initial states, and repeatedly executes a mutated copy of one of them; the registers, the opcode
+// and operand bytes, and the memory read by the instruction are mutated. A mutant is added to the corpus if it takes
+// an edge of the control flow graph of 6502.c that wasn't taken before, or takes an edge a different number of times
+// (counted in powers of two). For this, 6502.c is compiled into sim65-fuzz with -fsanitize-coverage=trace-pc, which
+// makes the compiler insert a call to __sanitizer_cov_trace_pc() in every basic block.
+//
+// Each mutant is also executed on the reference core (see sim65-reference.h), and sim65 is checked for deviations:
+//
+// - a difference with the reference core in the registers, the memory, or the cycle count;
+// - a violated invariant: the cycle count is not between 2 (1 on the 65C02) and 8, bits 4 and 5 of P are not set, or the instruction
+//   made more bus accesses than it took cycles.
+//
+// Instructions for which sim65 reports an error (illegal opcodes) are not checked.
+//
+// The initial states that increase coverage are written to DIR/coverage.json, and those that deviate to
+// DIR/deviations.json, at most one per opcode and kind of deviation. Both files are in the 65x02 JSON format, with
+// the outcome of the reference core as the final state, so they can be replayed with sim65-test. The "cycles" of a
+// test case are the bus accesses of the reference core, padded with reads of the final PC up to its cycle count,
+// as sim65 doesn't make the dummy accesses of a real 6502.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "cJSON.h"
+#include "6502.h"
+#include "memory.h"
+
+#include "sim65-testcase.h"
+#include "sim65-reference.h"
+#include "sim65-reference-access.h"
+
+// The memory of the reference core.
+static uint8_t * reference_memory;
+
+// Edge coverage. Each basic block of 6502.c is identified by a hash of its address; an edge is identified by the
+// blocks it connects, as in AFL. The edges taken by an execution are listed, so they can be examined and cleared
+// without scanning the whole map.
+
+#define COVERAGE_MAP_SIZE   0x10000
+#define COVERAGE_MAX_EDGES  1024
+
+static uint8_t coverage_hits[COVERAGE_MAP_SIZE];      // Hit count of each edge in the current execution.
+static uint8_t coverage_classes[COVERAGE_MAP_SIZE];   // Hit count classes seen for each edge so far.
+static uint16_t coverage_edges[COVERAGE_MAX_EDGES];   // The edges taken in the current execution.
+static unsigned coverage_edge_count;
+static unsigned coverage_previous_block;
+
+void __sanitizer_cov_trace_pc(void)
+{
+    uint32_t location = (uint32_t)(uintptr_t)__builtin_return_address(0);
+    unsigned block = (location * 2654435761u) >> 16;
+    unsigned edge = (block ^ coverage_previous_block) & (COVERAGE_MAP_SIZE - 1);
+
+    coverage_previous_block = block >> 1;
+
+    if (coverage_hits[edge] == 0)
+    {
+        if (coverage_edge_count == COVERAGE_MAX_EDGES)
+        {
+            return;
+        }
+        coverage_edges[coverage_edge_count++] = edge;
+    }
+
+    if (coverage_hits[edge] != 0xff)
+    {
+        ++coverage_hits[edge];
+    }
+}
+
+static uint8_t hit_count_class(uint8_t hits)
+{
+    if (hits < 4)
+    {
+        return (hits == 3) ? 4 : hits;
+    }
+
+    uint8_t hit_class = 8;
+    for (unsigned limit = 8; hits >= limit && hit_class != 0x80; limit *= 2)
+    {
+        hit_class <<= 1;
+    }
+    return hit_class;
+}
+
+// Account for the edges taken by the last execution, and clear them. Returns true if they include a new edge, or
+// a known edge with a new hit count class.
+static bool update_coverage(unsigned * covered_edges)
+{
+    bool novel = false;
+
+    for (unsigned i = 0; i < coverage_edge_count; ++i)
+    {
+        unsigned edge = coverage_edges[i];
+        uint8_t hit_class = hit_count_class(coverage_hits[edge]);
+
+        if ((hit_class & ~coverage_classes[edge]) != 0)
+        {
+            if (coverage_classes[edge] == 0)
+            {
+                ++*covered_edges;
+            }
+            coverage_classes[edge] |= hit_class;
+            novel = true;
+        }
+
+        coverage_hits[edge] = 0;
+    }
+
+    coverage_edge_count = 0;
+    coverage_previous_block = 0;
+
+    return novel;
+}
+
+// Random numbers (xorshift64*).
+
+static uint64_t random_state;
+
+static uint64_t random_next(void)
+{
+    random_state ^= random_state >> 12;
+    random_state ^= random_state << 25;
+    random_state ^= random_state >> 27;
+    return random_state * 0x2545f4914f6cdd1dULL;
+}
+
+static unsigned random_below(unsigned n)
+{
+    return (random_next() >> 32) % n;
+}
+
+static uint8_t random_byte(void)
+{
+    // Values at the edges of the signed, unsigned and BCD ranges turn up more often than at random.
+    static const uint8_t interesting_bytes[] = { 0x00, 0x01, 0x09, 0x0a, 0x0f, 0x10, 0x7f, 0x80, 0x99, 0x9a, 0xfe, 0xff };
+
+    if (random_below(4) == 0)
+    {
+        return interesting_bytes[random_below(sizeof(interesting_bytes))];
+    }
+    return random_next() >> 56;
+}
+
+// An initial state. The first three RAM assignments are the bytes of the instruction, at PC, PC+1 and PC+2; the
+// others are data. If an address is assigned more than once, the last assignment counts, as in sim65-test.
+
+#define FUZZ_MAX_RAM    16
+#define FUZZ_MAX_HINTS   8
+
+struct fuzz_input_type
+{
+    uint16_t pc;
+    uint8_t s;
+    uint8_t a;
+    uint8_t x;
+    uint8_t y;
+    uint8_t p;
+    unsigned ram_size;
+    struct ram_assignment_type ram[FUZZ_MAX_RAM];
+};
+
+struct corpus_entry_type
+{
+    struct fuzz_input_type input;
+    unsigned hint_count;
+    uint16_t hints[FUZZ_MAX_HINTS];  // Addresses of data read by the instruction; good places to mutate memory.
+};
+
+struct corpus_type
+{
+    struct corpus_entry_type * entries;
+    unsigned size;
+    unsigned capacity;
+};
+
+static void set_input_pc(struct fuzz_input_type * input, uint16_t pc)
+{
+    input->pc = pc;
+    for (unsigned i = 0; i < 3; ++i)
+    {
+        input->ram[i].address = pc + i;
+    }
+}
+
+static void set_input_memory(struct fuzz_input_type * input, uint16_t address, uint8_t value)
+{
+    for (unsigned i = 3; i < input->ram_size; ++i)
+    {
+        if (input->ram[i].address == address)
+        {
+            input->ram[i].value = value;
+            return;
+        }
+    }
+
+    unsigned i = (input->ram_size < FUZZ_MAX_RAM) ? input->ram_size++ : 3 + random_below(FUZZ_MAX_RAM - 3);
+    input->ram[i].address = address;
+    input->ram[i].value = value;
+}
+
+// The value of a memory location at the start of the instruction.
+static uint8_t get_input_memory(const struct fuzz_input_type * input, uint16_t address)
+{
+    uint8_t value = 0;
+    for (unsigned i = 0; i < input->ram_size; ++i)
+    {
+        if (input->ram[i].address == address)
+        {
+            value = input->ram[i].value;
+        }
+    }
+    return value;
+}
+
+static void random_input(struct fuzz_input_type * input, uint8_t opcode)
+{
+    input->s = random_next() >> 56;
+    input->a = random_next() >> 56;
+    input->x = random_next() >> 56;
+    input->y = random_next() >> 56;
+    input->p = random_next() >> 56;
+    input->ram_size = 3;
+    set_input_pc(input, random_next() >> 48);
+    input->ram[0].value = opcode;
+    input->ram[1].value = random_next() >> 56;
+    input->ram[2].value = random_next() >> 56;
+}
+
+// Apply one to four random mutations. The opcode is only mutated if it is not fixed.
+static void mutate_input(struct fuzz_input_type * input, const struct corpus_entry_type * parent, bool fixed_opcode)
+{
+    unsigned mutation_count = 1 + random_below(4);
+
+    for (unsigned i = 0; i < mutation_count; ++i)
+    {
+        switch (random_below(7))
+        {
+            case 0:
+            {
+                uint8_t * registers[5] = { &input->a, &input->x, &input->y, &input->s, &input->p };
+                *registers[random_below(5)] = random_byte();
+                break;
+            }
+            case 1:
+                input->p ^= 1 << random_below(8);
+                break;
+            case 2:
+                input->ram[1 + random_below(2)].value = random_byte();
+                break;
+            case 3:
+                if (!fixed_opcode)
+                {
+                    input->ram[0].value = random_next() >> 56;
+                }
+                break;
+            case 4:
+                // Instructions at the end of a page cross it to fetch their operands.
+                if (random_below(2) == 0)
+                {
+                    set_input_pc(input, (random_next() >> 48 & 0xff00) | (0xfd + random_below(3)));
+                }
+                else
+                {
+                    set_input_pc(input, random_next() >> 48);
+                }
+                break;
+            case 5:
+                if (parent->hint_count != 0)
+                {
+                    set_input_memory(input, parent->hints[random_below(parent->hint_count)], random_byte());
+                }
+                break;
+            case 6:
+                set_input_memory(input, random_next() >> 48, random_byte());
+                break;
+        }
+    }
+}
+
+static int corpus_add(struct corpus_type * corpus, const struct fuzz_input_type * input)
+{
+    if (corpus->size == corpus->capacity)
+    {
+        unsigned new_capacity = (corpus->capacity == 0) ? 1024 : 2 * corpus->capacity;
+        struct corpus_entry_type * new_entries = realloc(corpus->entries, new_capacity * sizeof(struct corpus_entry_type));
+        if (new_entries == NULL)
+        {
+            return -1;
+        }
+        corpus->entries = new_entries;
+        corpus->capacity = new_capacity;
+    }
+
+    struct corpus_entry_type * entry = &corpus->entries[corpus->size++];
+
+    entry->input = *input;
+    entry->hint_count = 0;
+
+    // The data read by sim65, other than the instruction itself.
+
+    const MemAccess * trace = MemTraceGetEntries();
+    unsigned trace_size = MemTraceGetSize();
+
+    for (unsigned i = 0; i < trace_size && entry->hint_count < FUZZ_MAX_HINTS; ++i)
+    {
+        if (!trace[i].Write && (uint16_t)(trace[i].Addr - input->pc) > 2)
+        {
+            entry->hints[entry->hint_count++] = trace[i].Addr;
+        }
+    }
+
+    return 0;
+}
+
+// Execution of an initial state on sim65 and the reference core.
+
+#define FUZZ_VIOLATION_CYCLES  0x01  // The cycle count is not between 2 (1 on the 65C02) and 8.
+#define FUZZ_VIOLATION_P       0x02  // Bit 4 or 5 of P is not set.
+#define FUZZ_VIOLATION_BUS     0x04  // More bus accesses than cycles.
+
+struct fuzz_outcome_type
+{
+    bool illegal;                            // sim65 reported an error; the outcome is not checked.
+    struct sim65_difference_type difference; // sim65 compared with the reference core.
+    unsigned violations;                     // FUZZ_VIOLATION_* flags.
+};
+
+// The 65C02 executes its undefined single-byte opcodes as one-cycle NOPs.
+static unsigned minimum_cycle_count(void)
+{
+    return (CPU == CPU_65C02) ? 1 : 2;
+}
+
+static void get_outcome(const CPURegs * regs, unsigned cycles, struct sim65_testcase_result_type * outcome)
+{
+    memset(outcome, 0, sizeof(*outcome));
+
+    outcome->pc = regs->PC;
+    outcome->s = regs->SP;
+    outcome->a = regs->AC;
+    outcome->x = regs->XR;
+    outcome->y = regs->YR;
+    outcome->p = regs->SR;
+    outcome->cycles = cycles;
+}
+
+// Find the lowest address at which the memory of sim65 and the reference core differ. Only the addresses that
+// were assigned or written to can differ, unless one of the journals overflowed, or the reference core doesn't
+// keep one.
+static bool find_memory_difference(const struct fuzz_input_type * input, uint16_t * address)
+{
+    bool found = false;
+
+    const uint16_t * reference_journal;
+    unsigned reference_journal_size;
+
+    if (MemJournalOverflowed() || !sim65_reference_journal(&reference_journal, &reference_journal_size))
+    {
+        if (memcmp(Mem, reference_memory, 0x10000) == 0)
+        {
+            return false;
+        }
+
+        for (unsigned i = 0; i < 0x10000 && !found; ++i)
+        {
+            if (Mem[i] != reference_memory[i])
+            {
+                *address = i;
+                found = true;
+            }
+        }
+        return found;
+    }
+
+    const uint16_t * journals[3] = { NULL, MemJournalGetEntries(), reference_journal };
+    unsigned journal_sizes[3] = { input->ram_size, MemJournalGetSize(), reference_journal_size };
+
+    for (unsigned j = 0; j < 3; ++j)
+    {
+        for (unsigned i = 0; i < journal_sizes[j]; ++i)
+        {
+            uint16_t candidate = (j == 0) ? input->ram[i].address : journals[j][i];
+            if (Mem[candidate] != reference_memory[candidate] && (!found || candidate < *address))
+            {
+                *address = candidate;
+                found = true;
+            }
+        }
+    }
+
+    return found;
+}
+
+static void execute_input(const struct fuzz_input_type * input, struct fuzz_outcome_type * outcome)
+{
+    Regs.AC = input->a;
+    Regs.XR = input->x;
+    Regs.YR = input->y;
+    Regs.SR = input->p | 0x30; // See fix_p_register_value() in sim65-testcase.c.
+    Regs.SP = input->s;
+    Regs.PC = input->pc;
+
+    const struct machine_state_type reference_state = { Regs.PC, Regs.SP, Regs.AC, Regs.XR, Regs.YR, Regs.SR, 0, NULL };
+
+    MemJournalClear();
+    MemTraceClear();
+
+    for (unsigned i = 0; i < input->ram_size; ++i)
+    {
+        Mem[input->ram[i].address] = input->ram[i].value;
+        reference_memory[input->ram[i].address] = input->ram[i].value;
+    }
+
+    unsigned cycles;
+    uint8_t notices = execute_instruction(0, &cycles);
+
+    struct sim65_difference_type * difference = &outcome->difference;
+
+    get_outcome(&Regs, cycles, &difference->sim65);
+    sim65_reference_execute(&reference_state, &difference->reference);
+
+    outcome->illegal = (notices & SIM65_NOTICE_ILLEGAL_INSTRUCTION) != 0;
+    outcome->violations = 0;
+    difference->differences = 0;
+
+    if (outcome->illegal)
+    {
+        return;
+    }
+
+    const struct sim65_testcase_result_type * sim65 = &difference->sim65;
+    const struct sim65_testcase_result_type * reference = &difference->reference;
+
+    static const uint16_t register_flags[6] = { SIM65_ERROR_A, SIM65_ERROR_X, SIM65_ERROR_Y, SIM65_ERROR_P, SIM65_ERROR_S, SIM65_ERROR_PC };
+    const unsigned sim65_values[6] = { sim65->a, sim65->x, sim65->y, sim65->p, sim65->s, sim65->pc };
+    const unsigned reference_values[6] = { reference->a, reference->x, reference->y, reference->p, reference->s, reference->pc };
+
+    for (unsigned i = 0; i < 6; ++i)
+    {
+        if (sim65_values[i] != reference_values[i])
+        {
+            difference->differences |= register_flags[i];
+        }
+    }
+
+    if (sim65->cycles != reference->cycles)
+    {
+        difference->differences |= SIM65_ERROR_CYCLES;
+    }
+
+    uint16_t address = 0;
+    if (find_memory_difference(input, &address))
+    {
+        difference->differences |= SIM65_ERROR_MEMORY;
+        difference->sim65.memory_address = address;
+        difference->sim65.memory_value = Mem[address];
+        difference->reference.memory_address = address;
+        difference->reference.memory_value = reference_memory[address];
+    }
+
+    if (cycles < minimum_cycle_count() || cycles > 8)
+    {
+        outcome->violations |= FUZZ_VIOLATION_CYCLES;
+    }
+
+    if ((Regs.SR & 0x30) != 0x30)
+    {
+        outcome->violations |= FUZZ_VIOLATION_P;
+    }
+
+    if (MemTraceGetSize() > cycles)
+    {
+        outcome->violations |= FUZZ_VIOLATION_BUS;
+    }
+}
+
+// Restore all memory to zero. If the reference core doesn't keep a journal, but its memory is the same as that of
+// sim65, the journal of sim65 covers its writes.
+static void restore_memory(const struct fuzz_input_type * input)
+{
+    const uint16_t * reference_journal = NULL;
+    unsigned reference_journal_size = 0;
+
+    if (MemJournalOverflowed() ||
+        (!sim65_reference_journal(&reference_journal, &reference_journal_size) && memcmp(Mem, reference_memory, 0x10000) != 0))
+    {
+        memset(Mem, 0, 0x10000);
+        memset(reference_memory, 0, 0x10000);
+        return;
+    }
+
+    const uint16_t * journal = MemJournalGetEntries();
+    unsigned journal_size = MemJournalGetSize();
+    for (unsigned i = 0; i < journal_size; ++i)
+    {
+        Mem[journal[i]] = 0;
+        reference_memory[journal[i]] = 0;
+    }
+
+    for (unsigned i = 0; i < reference_journal_size; ++i)
+    {
+        Mem[reference_journal[i]] = 0;
+        reference_memory[reference_journal[i]] = 0;
+    }
+
+    for (unsigned i = 0; i < input->ram_size; ++i)
+    {
+        Mem[input->ram[i].address] = 0;
+        reference_memory[input->ram[i].address] = 0;
+    }
+}
+
+// Output of test cases in the 65x02 JSON format; each file holds an array with one test case per line.
+
+struct fuzz_output_type
+{
+    FILE * file;
+    char * filename;
+    unsigned testcase_count;
+};
+
+static int open_output(struct fuzz_output_type * output, const char * directory, const char * name)
+{
+    output->filename = malloc(strlen(directory) + strlen(name) + 2);
+    if (output->filename == NULL)
+    {
+        return -1;
+    }
+    sprintf(output->filename, "%s/%s", directory, name);
+
+    output->file = fopen(output->filename, "w");
+    if (output->file == NULL)
+    {
+        free(output->filename);
+        return -1;
+    }
+
+    output->testcase_count = 0;
+    fputs("[", output->file);
+    return 0;
+}
+
+static void close_output(struct fuzz_output_type * output)
+{
+    fputs("\n]\n", output->file);
+    fclose(output->file);
+    free(output->filename);
+}
+
+static void add_json_ram_assignment(cJSON * ram, uint16_t address, uint8_t value)
+{
+    const int assignment[2] = { address, value };
+    cJSON_AddItemToArray(ram, cJSON_CreateIntArray(assignment, 2));
+}
+
+static cJSON * add_json_machine_state(cJSON * testcase, const char * field_name, unsigned pc, unsigned s, unsigned a, unsigned x, unsigned y, unsigned p)
+{
+    cJSON * state = cJSON_AddObjectToObject(testcase, field_name);
+    cJSON_AddNumberToObject(state, "pc", pc);
+    cJSON_AddNumberToObject(state, "s", s);
+    cJSON_AddNumberToObject(state, "a", a);
+    cJSON_AddNumberToObject(state, "x", x);
+    cJSON_AddNumberToObject(state, "y", y);
+    cJSON_AddNumberToObject(state, "p", p);
+    return cJSON_AddArrayToObject(state, "ram");
+}
+
+// Whether the address is assigned by one of the first 'count' assignments.
+static bool is_assigned(const struct ram_assignment_type * ram, unsigned count, uint16_t address)
+{
+    for (unsigned i = 0; i < count; ++i)
+    {
+        if (ram[i].address == address)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Write an initial state that was just executed, before its memory is restored, with the outcome of the reference
+// core as its final state. Returns the index of the test case in the output file, counting from 1.
+static unsigned write_testcase(struct fuzz_output_type * output, const struct fuzz_input_type * input, const char * name,
+                               const struct sim65_testcase_result_type * reference)
+{
+    cJSON * testcase = cJSON_CreateObject();
+
+    cJSON_AddStringToObject(testcase, "name", name);
+
+    // The initial state lists each address once, with the value it has when the instruction starts.
+
+    cJSON * ram = add_json_machine_state(testcase, "initial", input->pc, input->s, input->a, input->x, input->y, input->p | 0x30);
+
+    struct ram_assignment_type final_ram[FUZZ_MAX_RAM + MEM_JOURNAL_CAPACITY];
+    unsigned final_ram_size = 0;
+
+    for (unsigned i = input->ram_size; i-- != 0; )
+    {
+        if (!is_assigned(final_ram, final_ram_size, input->ram[i].address))
+        {
+            final_ram[final_ram_size++] = input->ram[i];
+        }
+    }
+
+    for (unsigned i = final_ram_size; i-- != 0; )
+    {
+        add_json_ram_assignment(ram, final_ram[i].address, final_ram[i].value);
+    }
+
+    // The final state lists the same addresses, and those written by the reference core. If the reference core
+    // doesn't keep a journal, the written addresses are found as the non-zero locations that weren't assigned;
+    // the others hold zero both before and after the instruction.
+
+    const uint16_t * journal;
+    unsigned journal_size;
+    if (sim65_reference_journal(&journal, &journal_size))
+    {
+        for (unsigned i = 0; i < journal_size; ++i)
+        {
+            if (!is_assigned(final_ram, final_ram_size, journal[i]))
+            {
+                final_ram[final_ram_size].address = journal[i];
+                ++final_ram_size;
+            }
+        }
+    }
+    else
+    {
+        for (unsigned address = 0; address < 0x10000 && final_ram_size < FUZZ_MAX_RAM + MEM_JOURNAL_CAPACITY; ++address)
+        {
+            if (reference_memory[address] != 0 && !is_assigned(final_ram, final_ram_size, address))
+            {
+                final_ram[final_ram_size].address = address;
+                ++final_ram_size;
+            }
+        }
+    }
+
+    ram = add_json_machine_state(testcase, "final", reference->pc, reference->s, reference->a, reference->x, reference->y, reference->p);
+
+    for (unsigned i = final_ram_size; i-- != 0; )
+    {
+        add_json_ram_assignment(ram, final_ram[i].address, reference_memory[final_ram[i].address]);
+    }
+
+    cJSON * cycles = cJSON_AddArrayToObject(testcase, "cycles");
+
+    struct bus_access_type trace[MEM_TRACE_CAPACITY];
+    unsigned trace_size = sim65_reference_trace(trace, MEM_TRACE_CAPACITY);
+
+    for (unsigned i = 0; i < reference->cycles; ++i)
+    {
+        struct bus_access_type access = { reference->pc, reference_memory[reference->pc], SIM65_BUS_READ };
+        if (i < trace_size)
+        {
+            access = trace[i];
+        }
+
+        cJSON * cycle = cJSON_CreateArray();
+        cJSON_AddItemToArray(cycle, cJSON_CreateNumber(access.address));
+        cJSON_AddItemToArray(cycle, cJSON_CreateNumber(access.value));
+        cJSON_AddItemToArray(cycle, cJSON_CreateString((access.type == SIM65_BUS_WRITE) ? "write" : "read"));
+        cJSON_AddItemToArray(cycles, cycle);
+    }
+
+    char * text = cJSON_PrintUnformatted(testcase);
+    if (text != NULL)
+    {
+        fprintf(output->file, "%s\n%s", (output->testcase_count == 0) ? "" : ",", text);
+        fflush(output->file);
+        free(text);
+    }
+
+    cJSON_Delete(testcase);
+
+    return ++output->testcase_count;
+}
+
+static void report_violations(const char * filename, unsigned testcase_index, const char * name, unsigned violations, unsigned cycles)
+{
+    if (violations & FUZZ_VIOLATION_CYCLES)
+    {
+        printf("[%s:%u (\"%s\")] VIOLATION - cycle count %u is not between %u and 8.\n", filename, testcase_index, name, cycles, minimum_cycle_count());
+    }
+
+    if (violations & FUZZ_VIOLATION_P)
+    {
+        printf("[%s:%u (\"%s\")] VIOLATION - bits 4 and 5 of the P register are not both set.\n", filename, testcase_index, name);
+    }
+
+    if (violations & FUZZ_VIOLATION_BUS)
+    {
+        printf("[%s:%u (\"%s\")] VIOLATION - more bus accesses than cycles (%u accesses in %u cycles).\n", filename, testcase_index, name,
+               MemTraceGetSize(), cycles);
+    }
+}
+
+static volatile sig_atomic_t stop_requested;
+
+static void handle_interrupt(int signal_number)
+{
+    (void)signal_number;
+    stop_requested = 1;
+}
+
+void print_help(void)
+{
+    puts("Usage: sim65-fuzz [--cpu-mode=<mode>] [--opcode=XX] [--iterations=N] [--seed=S] [--output-dir=DIR]");
+    puts("");
+    puts("Fuzz sim65's ExecuteInsn, guided by the edge coverage of 6502.c, and compare each outcome with");
+    puts("the reference core that is linked into sim65-fuzz ('make REFERENCE_DIR=... sim65-fuzz').");
+    puts("");
+    puts("  --cpu-mode=<mode>  Simulate a 6502 (the default), 65C02, or 6502X processor.");
+    puts("  --opcode=XX        Only fuzz the instruction with the given hexadecimal opcode.");
+    puts("  --iterations=N     Stop after N executions (default 10000000). Ctrl-C also stops.");
+    puts("  --seed=S           Seed of the random mutations (default 0).");
+    puts("  --output-dir=DIR   Directory for coverage.json and deviations.json (default '.').");
+    puts("");
+    puts("The initial states that reach new code paths are written to coverage.json, and those for which");
+    puts("sim65 deviates from the reference core or violates an invariant to deviations.json, at most one per");
+    puts("opcode and kind of deviation. Both can be replayed with sim65-test.");
+}
+
+int main(int argc, char ** argv)
+{
+    enum sim65_cpu_mode_type cpu_mode = SIM65_CPU_6502;
+    int fixed_opcode = -1;
+    unsigned long long iterations = 10000000;
+    uint64_t seed = 0;
+    const char * output_directory = ".";
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0)
+        {
+            print_help();
+            return EXIT_SUCCESS;
+        }
+        else if (strcmp(argv[i], "--cpu-mode=6502") == 0)
+        {
+            cpu_mode = SIM65_CPU_6502;
+        }
+        else if (strcmp(argv[i], "--cpu-mode=65C02") == 0)
+        {
+            cpu_mode = SIM65_CPU_65C02;
+        }
+        else if (strcmp(argv[i], "--cpu-mode=6502X") == 0)
+        {
+            cpu_mode = SIM65_CPU_6502X;
+        }
+        else if (strncmp(argv[i], "--opcode=", 9) == 0)
+        {
+            char * endptr;
+            long value = strtol(argv[i] + 9, &endptr, 16);
+            if (argv[i][9] == '\0' || *endptr != '\0' || value < 0 || value > 0xff)
+            {
+                printf("Bad opcode: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+            fixed_opcode = value;
+        }
+        else if (strncmp(argv[i], "--iterations=", 13) == 0 || strncmp(argv[i], "--seed=", 7) == 0)
+        {
+            bool is_seed = (argv[i][2] == 's');
+            const char * value_string = argv[i] + (is_seed ? 7 : 13);
+            char * endptr;
+            errno = 0;
+            unsigned long long value = strtoull(value_string, &endptr, 10);
+            if (*value_string == '\0' || *endptr != '\0' || errno != 0 || *value_string == '-')
+            {
+                printf("Bad %s: %s\n", is_seed ? "seed" : "number of iterations", argv[i]);
+                return EXIT_FAILURE;
+            }
+            if (is_seed)
+            {
+                seed = value;
+            }
+            else
+            {
+                iterations = value;
+            }
+        }
+        else if (strncmp(argv[i], "--output-dir=", 13) == 0)
+        {
+            output_directory = argv[i] + 13;
+        }
+        else
+        {
+            printf("Unknown option: %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (mkdir(output_directory, 0777) != 0 && errno != EEXIST)
+    {
+        printf("Unable to create output directory: %s\n", output_directory);
+        return EXIT_FAILURE;
+    }
+
+    struct fuzz_output_type coverage_output;
+    struct fuzz_output_type deviation_output;
+
+    if (open_output(&coverage_output, output_directory, "coverage.json") != 0)
+    {
+        printf("Unable to create output file in: %s\n", output_directory);
+        return EXIT_FAILURE;
+    }
+
+    if (open_output(&deviation_output, output_directory, "deviations.json") != 0)
+    {
+        printf("Unable to create output file in: %s\n", output_directory);
+        close_output(&coverage_output);
+        return EXIT_FAILURE;
+    }
+
+    // The state of xorshift64* must not be zero.
+    random_state = seed ^ 0x9e3779b97f4a7c15ULL;
+    random_state = (random_state != 0) ? random_state : 1;
+
+    static const CPUType cpu_types[3] = { CPU_6502, CPU_65C02, CPU_6502X };
+    CPU = cpu_types[cpu_mode];
+
+    MemJournalEnable(true);
+
+    Reset();
+    sim65_reference_reset(cpu_mode, true);
+    reference_memory = sim65_reference_memory();
+
+    MemTraceEnable(true);
+
+    signal(SIGINT, handle_interrupt);
+
+    struct corpus_type corpus = { NULL, 0, 0 };
+    uint32_t reported_deviations[256] = { 0 };  // Per opcode, the kinds of deviation written so far.
+    unsigned covered_edges = 0;
+    unsigned deviation_count = 0;
+    clock_t start_time = clock();
+    unsigned long long iteration;
+
+    for (iteration = 0; iteration < iterations && !stop_requested; ++iteration)
+    {
+        struct fuzz_input_type input;
+
+        // The corpus starts with a random initial state for each opcode that is fuzzed.
+
+        unsigned seed_count = (fixed_opcode < 0) ? 256 : 1;
+
+        if (iteration < seed_count)
+        {
+            random_input(&input, (fixed_opcode < 0) ? iteration : (unsigned)fixed_opcode);
+        }
+        else
+        {
+            const struct corpus_entry_type * parent = &corpus.entries[random_below(corpus.size)];
+            input = parent->input;
+            mutate_input(&input, parent, fixed_opcode >= 0);
+        }
+
+        // Test cases are named after the bytes of their instruction, as in the 65x02 test suite.
+
+        uint8_t opcode = get_input_memory(&input, input.pc);
+        char name[16];
+        snprintf(name, sizeof(name), "%02x %02x %02x", opcode, get_input_memory(&input, input.pc + 1), get_input_memory(&input, input.pc + 2));
+
+        struct fuzz_outcome_type outcome;
+        execute_input(&input, &outcome);
+
+        bool novel = update_coverage(&covered_edges);
+
+        if (novel || iteration < seed_count)
+        {
+            if (corpus_add(&corpus, &input) != 0)
+            {
+                printf("Out of memory.\n");
+                break;
+            }
+
+            if (novel)
+            {
+                write_testcase(&coverage_output, &input, name, &outcome.difference.reference);
+            }
+        }
+
+        uint32_t deviations = outcome.difference.differences | (outcome.violations << 16);
+
+        if ((deviations & ~reported_deviations[opcode]) != 0)
+        {
+            reported_deviations[opcode] |= deviations;
+            ++deviation_count;
+
+            unsigned testcase_index = write_testcase(&deviation_output, &input, name, &outcome.difference.reference);
+
+            struct sim65_testcase_specification_type testcase;
+            memset(&testcase, 0, sizeof(testcase));
+            testcase.name = name;
+
+            report_differential_result(&testcase, &outcome.difference, deviation_output.filename, testcase_index, stdout);
+            report_violations(deviation_output.filename, testcase_index, name, outcome.violations, outcome.difference.sim65.cycles);
+        }
+
+        restore_memory(&input);
+    }
+
+    double seconds = (double)(clock() - start_time) / CLOCKS_PER_SEC;
+
+    printf("[sim65-fuzz] INFO - %llu executions in %.1f seconds; %u edges covered by %u test cases; %u deviations.\n",
+           iteration, seconds, covered_edges, coverage_output.testcase_count, deviation_count);
+
+    close_output(&coverage_output);
+    close_output(&deviation_output);
+    free(corpus.entries);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,76 @@
+
+////////////////////////
+// sim65-gendecimal.c //
+////////////////////////
+
+// Build tool that generates the decimal mode tables of the simulator core (see decimal.h).
+//
+// Usage: sim65-gendecimal > decimal-tables.c
+//
+// Each entry is computed by executing ADC or SBC in decimal mode, as specified by the macros of 6502.c, for the
+// accumulator, operand and carry of its index. 6502.c itself looks up the entries instead of executing the macros,
+// unless SIM65_GENDECIMAL is defined; then, it only defines its data and macros, so it is included here.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SIM65_GENDECIMAL
+#include "6502.c"
+
+enum decimal_operation_type
+{
+    ADC_6502,
+    ADC_65C02,
+    SBC_6502,
+    SBC_65C02
+};
+
+static const char * const table_names[4] = { "DecimalADC6502", "DecimalADC65C02", "DecimalSBC6502", "DecimalSBC65C02" };
+
+static uint16_t table_entry(enum decimal_operation_type operation, uint8_t ac, uint8_t operand, bool carry)
+{
+    Regs.AC = ac;
+    Regs.SR = carry ? CF : 0;
+
+    switch (operation)
+    {
+        case ADC_6502:  ADC_DECIMAL_MODE_6502(operand);  break;
+        case ADC_65C02: ADC_DECIMAL_MODE_65C02(operand); break;
+        case SBC_6502:  SBC_DECIMAL_MODE_6502(operand);  break;
+        case SBC_65C02: SBC_DECIMAL_MODE_65C02(operand); break;
+    }
+
+    return ((Regs.SR & (SF | OF | ZF | CF)) << 8) | Regs.AC;
+}
+
+int main(void)
+{
+    printf("\n");
+    printf("// Generated by sim65-gendecimal; do not edit.\n");
+    printf("\n");
+    printf("#include <stdint.h>\n");
+
+    for (unsigned operation = ADC_6502; operation <= SBC_65C02; ++operation)
+    {
+        printf("\n");
+        printf("const uint16_t %s[0x%x] = {\n", table_names[operation], DECIMAL_TABLE_SIZE);
+        for (unsigned index = 0; index < DECIMAL_TABLE_SIZE; ++index)
+        {
+            // The index is DECIMAL_INDEX(AC, Operand, Carry).
+            uint16_t entry = table_entry(operation, (index >> 8) & 0xff, index & 0xff, (index >> 16) != 0);
+            printf("%s0x%04x,%s", (index % 16 == 0) ? "    " : "", entry, (index % 16 == 15) ? "\n" : " ");
+        }
+        printf("};\n");
+    }
+
+    printf("\n");
+    printf("const uint8_t NZFlags[0x100] = {\n");
+    for (unsigned value = 0; value < 0x100; ++value)
+    {
+        unsigned flags = (value & SF) | (value == 0 ? ZF : 0);
+        printf("%s0x%02x,%s", (value % 16 == 0) ? "    " : "", flags, (value % 16 == 15) ? "\n" : " ");
+    }
+    printf("};\n");
+
+    return ferror(stdout) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,95 @@
+
+///////////////////////
+// sim65-jsonindex.c //
+///////////////////////
+
+#include "sim65-jsonindex.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIM65_JSON_X86
+#endif
+
+static uint64_t classify_block_scalar(const char * block)
+{
+    uint64_t mask = 0;
+    for (unsigned i = 0; i < SIM65_JSON_BLOCK_SIZE; ++i)
+    {
+        char c = block[i];
+        // '[' and ']' differ from '{' and '}' only in bit 5.
+        char folded = c | 0x20;
+        if (c == '"' || c == '\\' || c == ',' || folded == '{' || folded == '}')
+        {
+            mask |= (uint64_t)1 << i;
+        }
+    }
+    return mask;
+}
+
+#if defined(SIM65_JSON_X86)
+
+__attribute__((target("sse2")))
+static uint64_t classify_block_sse2(const char * block)
+{
+    const __m128i quote     = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i comma     = _mm_set1_epi8(',');
+    const __m128i bit5      = _mm_set1_epi8(0x20);
+    const __m128i open      = _mm_set1_epi8('{');
+    const __m128i close     = _mm_set1_epi8('}');
+
+    uint64_t mask = 0;
+    for (unsigned i = 0; i < SIM65_JSON_BLOCK_SIZE; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(block + i));
+        __m128i folded = _mm_or_si128(v, bit5);
+        __m128i structural = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+            _mm_or_si128(_mm_cmpeq_epi8(v, comma),
+                         _mm_or_si128(_mm_cmpeq_epi8(folded, open), _mm_cmpeq_epi8(folded, close))));
+        mask |= (uint64_t)(uint16_t)_mm_movemask_epi8(structural) << i;
+    }
+    return mask;
+}
+
+__attribute__((target("avx2")))
+static uint64_t classify_block_avx2(const char * block)
+{
+    const __m256i quote     = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i comma     = _mm256_set1_epi8(',');
+    const __m256i bit5      = _mm256_set1_epi8(0x20);
+    const __m256i open      = _mm256_set1_epi8('{');
+    const __m256i close     = _mm256_set1_epi8('}');
+
+    uint64_t mask = 0;
+    for (unsigned i = 0; i < SIM65_JSON_BLOCK_SIZE; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(block + i));
+        __m256i folded = _mm256_or_si256(v, bit5);
+        __m256i structural = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, backslash)),
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, comma),
+                            _mm256_or_si256(_mm256_cmpeq_epi8(folded, open), _mm256_cmpeq_epi8(folded, close))));
+        mask |= (uint64_t)(uint32_t)_mm256_movemask_epi8(structural) << i;
+    }
+    return mask;
+}
+
+#endif
+
+sim65_json_classifier_type sim65_json_select_classifier(void)
+{
+#if defined(SIM65_JSON_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return classify_block_avx2;
+    }
+    if (__builtin_cpu_supports("sse2"))
+    {
+        return classify_block_sse2;
+    }
+#endif
+    return classify_block_scalar;
+}
@@ -0,0 +1,30 @@
+
+///////////////////////
+// sim65-jsonindex.h //
+///////////////////////
+
+// Classification of JSON text in blocks of 64 bytes.
+//
+// To find the boundaries of the test cases in a JSON test case file, we only need to look at the characters that
+// determine its structure: quotes, backslashes, brackets, braces, and commas. Rather than examining every byte of
+// the file, the text is classified 64 bytes at a time into a bit mask of the positions of those characters, and
+// the scanner jumps from one set bit to the next.
+//
+// On x86 processors, the classification is done with SSE2 or, if the processor supports it, AVX2 instructions.
+// Elsewhere, a portable scalar implementation is used.
+
+#ifndef SIM65_JSONINDEX_H
+#define SIM65_JSONINDEX_H
+
+#include <stdint.h>
+
+#define SIM65_JSON_BLOCK_SIZE 64
+
+// Returns a mask that has bit i set if block[i] is one of '"', '\\', '{', '}', '[', ']', or ','.
+// The block must be SIM65_JSON_BLOCK_SIZE bytes long.
+typedef uint64_t (*sim65_json_classifier_type)(const char * block);
+
+// Select the fastest classifier supported by the processor we're running on.
+sim65_json_classifier_type sim65_json_select_classifier(void);
+
+#endif
@@ -0,0 +1,91 @@
+
+//////////////////////
+// sim65-manifest.c //
+//////////////////////
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "sim65-manifest.h"
+
+static const char * const cpu_mode_names[3] = { "6502", "65C02", "6502X" };
+
+int sim65_manifest_load(struct sim65_manifest_type * manifest, const char * filename)
+{
+    memset(manifest, 0, sizeof(*manifest));
+    manifest->filename = filename;
+
+    FILE * f = fopen(filename, "r");
+    if (f == NULL)
+    {
+        return (errno == ENOENT) ? 0 : -1; // A missing manifest is empty.
+    }
+
+    char line[256];
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        char cpu_mode_name[8];
+        unsigned opcode;
+        unsigned test_flags;
+        unsigned long long fingerprint;
+        unsigned testcase_count;
+
+        if (sscanf(line, "%7s %x %u %llx %u", cpu_mode_name, &opcode, &test_flags, &fingerprint, &testcase_count) != 5 ||
+            opcode > 0xff || test_flags > SIM65_MANIFEST_TEST_FLAGS)
+        {
+            continue; // Ignore malformed lines.
+        }
+
+        for (unsigned cpu_mode = 0; cpu_mode < 3; ++cpu_mode)
+        {
+            if (strcmp(cpu_mode_name, cpu_mode_names[cpu_mode]) == 0)
+            {
+                manifest->entries[cpu_mode][opcode][test_flags].fingerprint = fingerprint;
+                manifest->entries[cpu_mode][opcode][test_flags].testcase_count = testcase_count;
+            }
+        }
+    }
+
+    fclose(f);
+
+    return 0;
+}
+
+void sim65_manifest_record(struct sim65_manifest_type * manifest, enum sim65_cpu_mode_type cpu_mode, unsigned opcode, unsigned test_flags,
+                           uint64_t fingerprint, unsigned testcase_count)
+{
+    struct sim65_manifest_entry_type * entry = &manifest->entries[cpu_mode][opcode][test_flags];
+
+    if (entry->fingerprint == fingerprint && entry->testcase_count == testcase_count)
+    {
+        return; // Nothing new.
+    }
+
+    entry->fingerprint = fingerprint;
+    entry->testcase_count = testcase_count;
+
+    FILE * f = fopen(manifest->filename, "a");
+    if (f != NULL)
+    {
+        fprintf(f, "%s %02x %u %016llx %u\n", cpu_mode_names[cpu_mode], opcode, test_flags, (unsigned long long)fingerprint, testcase_count);
+        fclose(f);
+    }
+}
+
+int sim65_testcase_file_opcode(const char * filename)
+{
+    const char * basename = strrchr(filename, '/');
+    basename = (basename != NULL) ? basename + 1 : filename;
+
+    unsigned opcode;
+    int length;
+    if (!isxdigit((unsigned char)basename[0]) || !isxdigit((unsigned char)basename[1]) ||
+        sscanf(basename, "%2x%n", &opcode, &length) != 1 || length != 2 || basename[2] != '.')
+    {
+        return -1;
+    }
+
+    return opcode;
+}
@@ -0,0 +1,54 @@
+
+//////////////////////
+// sim65-manifest.h //
+//////////////////////
+
+// The manifest used by --changed-only.
+//
+// The manifest records, for each CPU mode, opcode, and combination of test flags, a fingerprint of the test case
+// file of that opcode and of the simulator code that it exercises (see sim65-fingerprint.c) at the time the file
+// last passed. It is a text file with one entry per line:
+//
+//   <cpu-mode> <opcode> <test-flags> <fingerprint> <testcase-count>
+//
+// New entries are appended to the file, and a later entry overrides an earlier one. Appending a single line is
+// atomic, so processes running in parallel (--jobs) can record entries in the same manifest.
+
+#ifndef SIM65_MANIFEST_H
+#define SIM65_MANIFEST_H
+
+#include <stdint.h>
+
+#include "sim65-testcase.h"
+
+#define SIM65_DEFAULT_MANIFEST_FILENAME "sim65-test.manifest"
+
+// The test flags that an entry can be recorded for.
+#define SIM65_MANIFEST_TEST_FLAGS (F_TEST_MEMORY | F_TEST_CYCLECOUNT | F_TEST_BUS)
+
+struct sim65_manifest_entry_type
+{
+    uint64_t fingerprint;   // Zero if there is no entry.
+    unsigned testcase_count;
+};
+
+struct sim65_manifest_type
+{
+    const char * filename;
+    struct sim65_manifest_entry_type entries[3][256][SIM65_MANIFEST_TEST_FLAGS + 1];
+};
+
+// Load the entries of a manifest file. A missing file is an empty manifest; malformed lines are ignored.
+// Returns 0 on success, and -1 if the file cannot be read.
+int sim65_manifest_load(struct sim65_manifest_type * manifest, const char * filename);
+
+// Record that the test case file of an opcode passed, appending the entry to the manifest file if it is new.
+// Failing to update the file only means that the test case file will be tested again next time.
+void sim65_manifest_record(struct sim65_manifest_type * manifest, enum sim65_cpu_mode_type cpu_mode, unsigned opcode, unsigned test_flags,
+                           uint64_t fingerprint, unsigned testcase_count);
+
+// Determine the opcode tested by a file from its name, which starts with the opcode in hexadecimal, as in the
+// 65x02 test suite (e.g., "6502/a9.json"). Returns -1 if the name doesn't look like that.
+int sim65_testcase_file_opcode(const char * filename);
+
+#endif
@@ -0,0 +1,136 @@
+
+//////////////////////////////
+// sim65-reference-access.c //
+//////////////////////////////
+
+// This file is compiled like the reference core: with the headers of the reference core first on the include
+// path, and with sim65-reference-names.h included in front of it, so that CPU, Regs, Mem and the functions of the
+// core below refer to the reference core, declared as the reference core declares them. The headers of the core
+// are included with angle brackets, so that they are not taken from the directory of this file.
+
+#include <string.h>
+
+#include <6502.h>
+#include <memory.h>
+
+#include "sim65-reference-access.h"
+
+/////////////////////////////////////////////////////////////////// start of re-implementation of functions that are called from the reference core.
+
+void ParaVirtHooks(CPURegs * Regs)
+{
+    (void)Regs;
+}
+
+void Error(const char * Format, ...)
+{
+    (void)Format;
+}
+
+void Warning(const char * Format, ...)
+{
+    (void)Format;
+}
+
+/////////////////////////////////////////////////////////////////// end of re-implementation of functions that are called from the reference core.
+
+bool sim65_reference_is_thread_local(void)
+{
+#if defined(THREADLOCAL_H) && defined(SIM65_THREADS)
+    return true;
+#else
+    return false; // The reference core predates threadlocal.h, or was built without SIM65_THREADS.
+#endif
+}
+
+void sim65_reference_reset(enum sim65_cpu_mode_type cpu_mode, bool record_accesses)
+{
+    static const CPUType cpu_types[3] = { CPU_6502, CPU_65C02, CPU_6502X };
+
+    CPU = cpu_types[cpu_mode];
+
+#if defined(MEM_JOURNAL_CAPACITY)
+    MemJournalEnable(record_accesses);
+#endif
+
+#if defined(MEM_TRACE_CAPACITY)
+    MemTraceEnable(record_accesses);
+#endif
+
+    (void)record_accesses;
+
+    Reset();
+}
+
+uint8_t * sim65_reference_memory(void)
+{
+    return Mem;
+}
+
+void sim65_reference_execute(const struct machine_state_type * state, struct sim65_testcase_result_type * outcome)
+{
+    Regs.AC = state->a;
+    Regs.XR = state->x;
+    Regs.YR = state->y;
+    Regs.SR = state->p;
+    Regs.SP = state->s;
+    Regs.PC = state->pc;
+
+#if defined(MEM_JOURNAL_CAPACITY)
+    MemJournalClear();
+#endif
+
+#if defined(MEM_TRACE_CAPACITY)
+    MemTraceClear();
+#endif
+
+    unsigned cycles = ExecuteInsn();
+
+    memset(outcome, 0, sizeof(*outcome));
+
+    outcome->pc = Regs.PC;
+    outcome->s = Regs.SP;
+    outcome->a = Regs.AC;
+    outcome->x = Regs.XR;
+    outcome->y = Regs.YR;
+    outcome->p = Regs.SR;
+    outcome->cycles = cycles;
+}
+
+bool sim65_reference_journal(const uint16_t ** entries, unsigned * size)
+{
+#if defined(MEM_JOURNAL_CAPACITY)
+    if (!MemJournalOverflowed())
+    {
+        *entries = MemJournalGetEntries();
+        *size = MemJournalGetSize();
+        return true;
+    }
+#else
+    (void)entries;
+    (void)size;
+#endif
+    return false;
+}
+
+unsigned sim65_reference_trace(struct bus_access_type * accesses, unsigned capacity)
+{
+    unsigned count = 0;
+
+#if defined(MEM_TRACE_CAPACITY)
+    const MemAccess * trace = MemTraceGetEntries();
+    unsigned trace_size = MemTraceGetSize();
+
+    for (; count < trace_size && count < capacity; ++count)
+    {
+        accesses[count].address = trace[count].Addr;
+        accesses[count].value = trace[count].Val;
+        accesses[count].type = trace[count].Write ? SIM65_BUS_WRITE : SIM65_BUS_READ;
+    }
+#else
+    (void)accesses;
+    (void)capacity;
+#endif
+
+    return count;
+}
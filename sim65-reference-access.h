@@ -0,0 +1,45 @@
+
+//////////////////////////////
+// sim65-reference-access.h //
+//////////////////////////////
+
+// Access to the reference core (see sim65-reference.h).
+//
+// The reference core can be built from an older revision of the simulator (see the Makefile), whose globals may be
+// declared differently from those of the core under test; before the test cases of a file could be executed on
+// several threads, they were not SIM65_THREAD_LOCAL. sim65-reference-access.c is therefore compiled against the
+// headers of the reference core, like the reference core itself, and the rest of sim65-test and sim65-fuzz only
+// access the reference core through the functions below, which use none of the types of the core.
+
+#ifndef SIM65_REFERENCE_ACCESS_H
+#define SIM65_REFERENCE_ACCESS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sim65-testcase.h"
+
+// Whether each thread has a reference core of its own. If not, only one thread at a time may use it.
+bool sim65_reference_is_thread_local(void);
+
+// Select the CPU of the reference core and reset it. If asked, the journal of memory writes and the trace of bus
+// accesses are enabled, if the reference core has them.
+void sim65_reference_reset(enum sim65_cpu_mode_type cpu_mode, bool record_accesses);
+
+// The 64 KiB of memory of the reference core.
+uint8_t * sim65_reference_memory(void);
+
+// Set the registers of the reference core to those of the state (its RAM assignments are not made), clear the
+// journal and the trace, and execute a single instruction. The registers and cycle count afterwards are stored
+// in the outcome; its other fields are zero.
+void sim65_reference_execute(const struct machine_state_type * state, struct sim65_testcase_result_type * outcome);
+
+// Get the addresses written by the last instruction. Returns false if the reference core doesn't keep a journal,
+// or the journal overflowed.
+bool sim65_reference_journal(const uint16_t ** entries, unsigned * size);
+
+// Copy up to 'capacity' bus accesses made by the last instruction. Returns the number of accesses copied, which is
+// zero if the reference core doesn't keep a trace.
+unsigned sim65_reference_trace(struct bus_access_type * accesses, unsigned capacity);
+
+#endif
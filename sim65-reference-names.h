@@ -0,0 +1,80 @@
+
+// NOTE: This header is specific to sim65-test; it has no counterpart in sim65.
+//
+// sim65-test can link a second copy of the simulator core, the reference core, to compare sim65 with (see
+// sim65-reference.h). The reference core is built from 6502.c, memory.c and peripherals.c like the core under
+// test, possibly from an older revision, with this header included in front of each file by the Makefile. It
+// renames every symbol that the core defines or uses from outside, so the two copies don't collide.
+
+#ifndef SIM65_REFERENCE_NAMES_H
+#define SIM65_REFERENCE_NAMES_H
+
+// 6502.c
+
+#define CPU                     RefCPU
+#define Regs                    RefRegs
+#define Reset                   RefReset
+#define IRQRequest              RefIRQRequest
+#define NMIRequest              RefNMIRequest
+#define ExecuteInsn             RefExecuteInsn
+#define RunInsns                RefRunInsns
+#define RunInsns6502            RefRunInsns6502
+#define RunInsns65C02           RefRunInsns65C02
+#define RunInsns6502X           RefRunInsns6502X
+#define HaveNMIRequest          RefHaveNMIRequest
+#define HaveIRQRequest          RefHaveIRQRequest
+#define RunBlocks               RefRunBlocks
+#define RunBlocks6502           RefRunBlocks6502
+#define RunBlocks65C02          RefRunBlocks65C02
+#define RunBlocks6502X          RefRunBlocks6502X
+#define FlushBlocks             RefFlushBlocks
+
+// decimal-tables.c
+
+#define DecimalADC6502          RefDecimalADC6502
+#define DecimalADC65C02         RefDecimalADC65C02
+#define DecimalSBC6502          RefDecimalSBC6502
+#define DecimalSBC65C02         RefDecimalSBC65C02
+#define NZFlags                 RefNZFlags
+
+// memory.c
+
+#define Mem                     RefMem
+#define MemReadFastLimit        RefMemReadFastLimit
+#define MemWriteFastLimit       RefMemWriteFastLimit
+#define MemWriteByteSlow        RefMemWriteByteSlow
+#define MemReadByteSlow         RefMemReadByteSlow
+#define MemWriteByte            RefMemWriteByte
+#define MemWriteWord            RefMemWriteWord
+#define MemReadByte             RefMemReadByte
+#define MemReadWord             RefMemReadWord
+#define MemReadZPWord           RefMemReadZPWord
+#define MemInit                 RefMemInit
+#define MemJournalEnable        RefMemJournalEnable
+#define MemJournalClear         RefMemJournalClear
+#define MemJournalGetSize       RefMemJournalGetSize
+#define MemJournalGetEntries    RefMemJournalGetEntries
+#define MemJournalOverflowed    RefMemJournalOverflowed
+#define MemTraceEnable          RefMemTraceEnable
+#define MemTraceClear           RefMemTraceClear
+#define MemTraceGetSize         RefMemTraceGetSize
+#define MemTraceGetEntries      RefMemTraceGetEntries
+#define MemTraceOverflowed      RefMemTraceOverflowed
+#define MemPageGeneration       RefMemPageGeneration
+#define MemPageGenerationsEnable RefMemPageGenerationsEnable
+#define MemPageWritten          RefMemPageWritten
+
+// peripherals.c
+
+#define Peripherals             RefPeripherals
+#define PeripheralsWriteByte    RefPeripheralsWriteByte
+#define PeripheralsReadByte     RefPeripheralsReadByte
+#define PeripheralsInit         RefPeripheralsInit
+
+// Called by the core; implemented for the reference core in sim65-reference-access.c.
+
+#define Error                   RefError
+#define Warning                 RefWarning
+#define ParaVirtHooks           RefParaVirtHooks
+
+#endif
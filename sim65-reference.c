@@ -0,0 +1,258 @@
+
+///////////////////////
+// sim65-reference.c //
+///////////////////////
+
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <pthread.h>
+
+#include "6502.h"
+#include "memory.h"
+
+#include "sim65-reference.h"
+#include "sim65-reference-access.h"
+
+// The reference core may be shared by all threads (see sim65_reference_is_thread_local()).
+static pthread_mutex_t shared_reference_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static CPUType cpu_type(enum sim65_cpu_mode_type cpu_mode)
+{
+    switch (cpu_mode)
+    {
+        case SIM65_CPU_6502:  return CPU_6502;
+        case SIM65_CPU_65C02: return CPU_65C02;
+        case SIM65_CPU_6502X: return CPU_6502X;
+    }
+
+    // Bad CPU mode. This should never happen.
+    assert(false);
+    return CPU_6502;
+}
+
+static void get_outcome(const CPURegs * regs, unsigned cycles, struct sim65_testcase_result_type * outcome)
+{
+    memset(outcome, 0, sizeof(*outcome));
+
+    outcome->pc = regs->PC;
+    outcome->s = regs->SP;
+    outcome->a = regs->AC;
+    outcome->x = regs->XR;
+    outcome->y = regs->YR;
+    outcome->p = regs->SR;
+    outcome->cycles = cycles;
+}
+
+int execute_differential_batch(const struct sim65_testcase_specification_type * testcases, unsigned count, enum sim65_cpu_mode_type cpu_mode, unsigned test_flags,
+                               struct sim65_difference_type * differences)
+{
+    bool shared_reference = !sim65_reference_is_thread_local();
+    if (shared_reference)
+    {
+        pthread_mutex_lock(&shared_reference_mutex);
+    }
+
+    CPU = cpu_type(cpu_mode);
+
+    uint8_t * reference_memory = sim65_reference_memory();
+
+    // As in execute_testcase_batch(), memory is all-zero between test cases, and the journal of sim65's writes is
+    // used to restore that. The reference core writes to the same locations unless the cores disagree.
+
+    MemJournalEnable(true);
+    MemTraceEnable(false);
+
+    Reset();
+    sim65_reference_reset(cpu_mode, false);
+
+    unsigned differing_testcases = 0;
+
+    for (unsigned testcase_index = 0; testcase_index < count; ++testcase_index)
+    {
+        const struct sim65_testcase_specification_type * testcase = &testcases[testcase_index];
+        struct sim65_difference_type * difference = &differences[testcase_index];
+
+        const struct machine_state_type * initial_state = &testcase->initial_state;
+
+        Regs.AC = initial_state->a;
+        Regs.XR = initial_state->x;
+        Regs.YR = initial_state->y;
+        Regs.SR = initial_state->p | 0x30; // See fix_p_register_value() in sim65-testcase.c.
+        Regs.SP = initial_state->s;
+        Regs.PC = initial_state->pc;
+
+        const struct machine_state_type reference_state = { Regs.PC, Regs.SP, Regs.AC, Regs.XR, Regs.YR, Regs.SR, 0, NULL };
+
+        MemJournalClear();
+
+        for (unsigned i = 0; i < initial_state->ram_size; ++i)
+        {
+            Mem[initial_state->ram[i].address] = initial_state->ram[i].value;
+            MemPageWritten(initial_state->ram[i].address); // See execute_testcase_batch() in sim65-testcase.c.
+            reference_memory[initial_state->ram[i].address] = initial_state->ram[i].value;
+        }
+
+        unsigned cycles;
+        uint8_t notices = execute_instruction(test_flags, &cycles);
+
+        get_outcome(&Regs, cycles, &difference->sim65);
+        sim65_reference_execute(&reference_state, &difference->reference);
+
+        const struct sim65_testcase_result_type * sim65 = &difference->sim65;
+        const struct sim65_testcase_result_type * reference = &difference->reference;
+
+        difference->differences = 0;
+
+        if (sim65->a != reference->a)
+        {
+            difference->differences |= SIM65_ERROR_A;
+        }
+
+        if (sim65->x != reference->x)
+        {
+            difference->differences |= SIM65_ERROR_X;
+        }
+
+        if (sim65->y != reference->y)
+        {
+            difference->differences |= SIM65_ERROR_Y;
+        }
+
+        if (sim65->p != reference->p)
+        {
+            difference->differences |= SIM65_ERROR_P;
+        }
+
+        if (sim65->s != reference->s)
+        {
+            difference->differences |= SIM65_ERROR_S;
+        }
+
+        if (sim65->pc != reference->pc)
+        {
+            difference->differences |= SIM65_ERROR_PC;
+        }
+
+        // The reference core is the same as sim65, or an older version of it, so it doesn't specify the cycle
+        // count of an instruction either where sim65 doesn't.
+        if ((test_flags & F_TEST_CYCLECOUNT) && !(notices & SIM65_NOTICE_CYCLES_UNSPECIFIED) && sim65->cycles != reference->cycles)
+        {
+            difference->differences |= SIM65_ERROR_CYCLES;
+        }
+
+        // Memory is always compared, as it must be restored to all-zero; a difference is only reported if asked for.
+
+        bool memory_differs = (memcmp(Mem, reference_memory, 0x10000) != 0);
+
+        if (memory_differs && (test_flags & F_TEST_MEMORY))
+        {
+            unsigned address = 0;
+            while (Mem[address] == reference_memory[address])
+            {
+                ++address;
+            }
+
+            difference->differences |= SIM65_ERROR_MEMORY;
+            difference->sim65.memory_address = address;
+            difference->sim65.memory_value = Mem[address];
+            difference->reference.memory_address = address;
+            difference->reference.memory_value = reference_memory[address];
+        }
+
+        if (memory_differs || MemJournalOverflowed())
+        {
+            memset(Mem, 0, 0x10000);
+            memset(reference_memory, 0, 0x10000);
+            FlushBlocks();
+        }
+        else
+        {
+            const uint16_t * journal = MemJournalGetEntries();
+            unsigned journal_size = MemJournalGetSize();
+            for (unsigned i = 0; i < journal_size; ++i)
+            {
+                Mem[journal[i]] = 0;
+                MemPageWritten(journal[i]);
+                reference_memory[journal[i]] = 0;
+            }
+
+            for (unsigned i = 0; i < initial_state->ram_size; ++i)
+            {
+                Mem[initial_state->ram[i].address] = 0;
+                MemPageWritten(initial_state->ram[i].address);
+                reference_memory[initial_state->ram[i].address] = 0;
+            }
+        }
+
+        if (difference->differences != 0)
+        {
+            ++differing_testcases;
+        }
+    }
+
+    if (shared_reference)
+    {
+        pthread_mutex_unlock(&shared_reference_mutex);
+    }
+
+    return differing_testcases;
+}
+
+int report_differential_result(const struct sim65_testcase_specification_type * testcase, const struct sim65_difference_type * difference,
+                               const char * filename, unsigned testcase_index, FILE * out)
+{
+    const struct sim65_testcase_result_type * sim65 = &difference->sim65;
+    const struct sim65_testcase_result_type * reference = &difference->reference;
+
+    if (difference->differences == 0)
+    {
+        return 0;
+    }
+
+    static const struct
+    {
+        uint16_t flag;
+        const char * name;
+        const char * format;
+    } registers[] = {
+        { SIM65_ERROR_A,  "A",  "0x%02x" },
+        { SIM65_ERROR_X,  "X",  "0x%02x" },
+        { SIM65_ERROR_Y,  "Y",  "0x%02x" },
+        { SIM65_ERROR_P,  "P",  "0x%02x" },
+        { SIM65_ERROR_S,  "S",  "0x%02x" },
+        { SIM65_ERROR_PC, "PC", "0x%04x" }
+    };
+
+    const unsigned sim65_values[6] = { sim65->a, sim65->x, sim65->y, sim65->p, sim65->s, sim65->pc };
+    const unsigned reference_values[6] = { reference->a, reference->x, reference->y, reference->p, reference->s, reference->pc };
+
+    for (unsigned i = 0; i < 6; ++i)
+    {
+        if (difference->differences & registers[i].flag)
+        {
+            char sim65_value[8];
+            char reference_value[8];
+            snprintf(sim65_value, sizeof(sim65_value), registers[i].format, sim65_values[i]);
+            snprintf(reference_value, sizeof(reference_value), registers[i].format, reference_values[i]);
+            fprintf(out, "[%s:%u (\"%s\")] DIFFERENCE - %s register differs (sim65: %s, reference: %s).\n", filename, testcase_index, testcase->name,
+                registers[i].name, sim65_value, reference_value);
+        }
+    }
+
+    if (difference->differences & SIM65_ERROR_CYCLES)
+    {
+        fprintf(out, "[%s:%u (\"%s\")] DIFFERENCE - cycle count differs (sim65: %u, reference: %u).\n", filename, testcase_index, testcase->name,
+            sim65->cycles, reference->cycles);
+    }
+
+    if (difference->differences & SIM65_ERROR_MEMORY)
+    {
+        fprintf(out, "[%s:%u (\"%s\")] DIFFERENCE - memory differs (address 0x%04x: sim65: 0x%02x, reference: 0x%02x).\n", filename, testcase_index, testcase->name,
+            sim65->memory_address, sim65->memory_value, reference->memory_value);
+    }
+
+    return -1;
+}
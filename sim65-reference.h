@@ -0,0 +1,46 @@
+
+///////////////////////
+// sim65-reference.h //
+///////////////////////
+
+// Differential testing against a reference core.
+//
+// sim65-test links a second copy of the simulator core, the reference core, which is built with its symbols
+// renamed (see sim65-reference-names.h). It can be built from an older, trusted revision of 6502.c, memory.c,
+// and peripherals.c; see the Makefile.
+//
+// With --differential, every test case is executed on both cores in lockstep: both start from the initial state
+// of the test case and execute its instruction, and then their registers, memory and cycle counts are compared
+// with each other, rather than with the final state specified by the test case. Only the test cases on which the
+// two cores disagree are reported. This verifies that a rewrite behaves exactly like the trusted core, including
+// where both deviate from the test cases.
+
+#ifndef SIM65_REFERENCE_H
+#define SIM65_REFERENCE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "sim65-testcase.h"
+
+struct sim65_difference_type
+{
+    uint16_t differences;                         // SIM65_ERROR_* flags for the values that differ.
+    struct sim65_testcase_result_type sim65;      // Outcome on sim65.
+    struct sim65_testcase_result_type reference;  // Outcome on the reference core.
+};
+
+// With SIM65_ERROR_MEMORY, memory_address holds the lowest address at which memory differs, in both outcomes.
+// The errors, notices, and bus fields of the outcomes are not used.
+
+// Execute a batch of test cases on both cores, storing the comparison of test case i in differences[i].
+// Nothing is printed. Returns the number of test cases on which the cores disagree.
+int execute_differential_batch(const struct sim65_testcase_specification_type * testcases, unsigned count, enum sim65_cpu_mode_type cpu_mode, unsigned test_flags,
+                               struct sim65_difference_type * differences);
+
+// Print the messages for a test case on which the cores disagree; prints nothing if they agree.
+// Returns -1 if the cores disagree, 0 otherwise.
+int report_differential_result(const struct sim65_testcase_specification_type * testcase, const struct sim65_difference_type * difference,
+                               const char * filename, unsigned testcase_index, FILE * out);
+
+#endif
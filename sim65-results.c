@@ -0,0 +1,356 @@
+
+/////////////////////
+// sim65-results.c //
+/////////////////////
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim65-results.h"
+
+// A record is assembled in a buffer, and handed to the stream in one piece by record_end(). The buffer starts out
+// on the stack; a record that doesn't fit (e.g., because of a long file name) continues in a buffer on the heap.
+
+struct record_buffer_type
+{
+    FILE * out;
+    size_t size;
+    size_t capacity;
+    char * data;              // Either 'local', or allocated on the heap.
+    char local[256];
+};
+
+// Make room for at least one more character. Returns -1 if that's not possible.
+static int record_grow(struct record_buffer_type * record)
+{
+    size_t new_capacity = 2 * record->capacity;
+    char * new_data = malloc(new_capacity);
+    if (new_data == NULL)
+    {
+        return -1; // malloc() error.
+    }
+
+    memcpy(new_data, record->data, record->size);
+    if (record->data != record->local)
+    {
+        free(record->data);
+    }
+
+    record->data = new_data;
+    record->capacity = new_capacity;
+    return 0;
+}
+
+static void record_flush(struct record_buffer_type * record)
+{
+    fwrite(record->data, 1, record->size, record->out);
+    record->size = 0;
+}
+
+static void record_char(struct record_buffer_type * record, char c)
+{
+    if (record->size == record->capacity && record_grow(record) != 0)
+    {
+        record_flush(record); // Out of memory: write the record in pieces rather than not at all.
+    }
+    record->data[record->size++] = c;
+}
+
+static void record_literal(struct record_buffer_type * record, const char * s)
+{
+    while (*s != '\0')
+    {
+        record_char(record, *s++);
+    }
+}
+
+static void record_uint(struct record_buffer_type * record, uint64_t value)
+{
+    char digits[20];
+    unsigned n = 0;
+    do
+    {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    } while (value != 0);
+
+    while (n != 0)
+    {
+        record_char(record, digits[--n]);
+    }
+}
+
+static void record_string(struct record_buffer_type * record, const char * s)
+{
+    static const char hex_digits[16] = "0123456789abcdef";
+
+    record_char(record, '"');
+    for (; *s != '\0'; ++s)
+    {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\')
+        {
+            record_char(record, '\\');
+            record_char(record, c);
+        }
+        else if (c < 0x20)
+        {
+            record_literal(record, "\\u00");
+            record_char(record, hex_digits[c >> 4]);
+            record_char(record, hex_digits[c & 15]);
+        }
+        else
+        {
+            record_char(record, c);
+        }
+    }
+    record_char(record, '"');
+}
+
+// Start a record with the "file" member.
+static void record_begin(struct record_buffer_type * record, FILE * out, const char * filename)
+{
+    record->out = out;
+    record->size = 0;
+    record->capacity = sizeof(record->local);
+    record->data = record->local;
+    record_literal(record, "{\"file\":");
+    record_string(record, filename);
+}
+
+static void record_end(struct record_buffer_type * record)
+{
+    record_literal(record, "}\n");
+    record_flush(record);
+
+    if (record->data != record->local)
+    {
+        free(record->data);
+    }
+}
+
+static void record_member(struct record_buffer_type * record, const char * name, uint64_t value)
+{
+    record_literal(record, name);
+    record_uint(record, value);
+}
+
+// Write the values selected by the SIM65_ERROR_* flags, as found in an outcome.
+static void record_values(struct record_buffer_type * record, uint16_t flags, const struct sim65_testcase_result_type * values)
+{
+    const char * separator = "{";
+
+    static const struct
+    {
+        uint16_t flag;
+        const char * name;
+    } registers[] = {
+        { SIM65_ERROR_A,  "\"a\":"  },
+        { SIM65_ERROR_X,  "\"x\":"  },
+        { SIM65_ERROR_Y,  "\"y\":"  },
+        { SIM65_ERROR_P,  "\"p\":"  },
+        { SIM65_ERROR_S,  "\"s\":"  },
+        { SIM65_ERROR_PC, "\"pc\":" }
+    };
+
+    const unsigned register_values[6] = { values->a, values->x, values->y, values->p, values->s, values->pc };
+
+    for (unsigned i = 0; i < 6; ++i)
+    {
+        if (flags & registers[i].flag)
+        {
+            record_literal(record, separator);
+            record_member(record, registers[i].name, register_values[i]);
+            separator = ",";
+        }
+    }
+
+    if (flags & SIM65_ERROR_CYCLES)
+    {
+        record_literal(record, separator);
+        record_member(record, "\"cycles\":", values->cycles);
+        separator = ",";
+    }
+
+    if (flags & SIM65_ERROR_MEMORY)
+    {
+        record_literal(record, separator);
+        record_member(record, "\"memory\":{\"address\":", values->memory_address);
+        record_member(record, ",\"value\":", values->memory_value);
+        record_char(record, '}');
+        separator = ",";
+    }
+
+    if (flags & SIM65_ERROR_BUS)
+    {
+        static const char * const type_names[3] = { "\"read\"", "\"write\"", "\"none\"" };
+
+        const struct bus_access_type * access = &values->bus_access;
+
+        record_literal(record, separator);
+        record_member(record, "\"bus\":{\"cycle\":", values->bus_cycle + 1);
+        record_literal(record, ",\"type\":");
+        record_literal(record, type_names[access->type]);
+        if (access->type != SIM65_BUS_NONE)
+        {
+            record_member(record, ",\"address\":", access->address);
+            record_member(record, ",\"value\":", access->value);
+        }
+        record_char(record, '}');
+    }
+
+    record_char(record, '}');
+}
+
+// The values that a test case expects, in the form of an outcome, for the checks that failed.
+static void get_expected_values(const struct sim65_testcase_specification_type * testcase, const struct sim65_testcase_result_type * result,
+                                struct sim65_testcase_result_type * values)
+{
+    const struct machine_state_type * state = &testcase->final_state;
+
+    *values = *result;
+
+    values->pc = state->pc;
+    values->s = state->s;
+    values->a = state->a;
+    values->x = state->x;
+    values->y = state->y;
+    values->p = state->p;
+    values->cycles = testcase->cycles;
+    values->memory_value = result->memory_expected;
+
+    if ((result->errors & SIM65_ERROR_BUS) && result->bus_cycle < testcase->cycles)
+    {
+        values->bus_access = testcase->bus[result->bus_cycle];
+    }
+    else
+    {
+        values->bus_access.type = SIM65_BUS_NONE;
+    }
+}
+
+// Write the "name" and "opcode" members of a test case record.
+static void record_testcase(struct record_buffer_type * record, const struct sim65_testcase_specification_type * testcase)
+{
+    record_literal(record, ",\"name\":");
+    record_string(record, testcase->name);
+
+    const struct machine_state_type * initial_state = &testcase->initial_state;
+    for (unsigned i = 0; i < initial_state->ram_size; ++i)
+    {
+        if (initial_state->ram[i].address == initial_state->pc)
+        {
+            record_member(record, ",\"opcode\":", initial_state->ram[i].value);
+            break;
+        }
+    }
+}
+
+int write_testcase_record(const struct sim65_testcase_specification_type * testcase, const struct sim65_testcase_result_type * result,
+                          const char * filename, unsigned testcase_index, FILE * out)
+{
+    struct record_buffer_type record;
+
+    record_begin(&record, out, filename);
+    record_member(&record, ",\"index\":", testcase_index);
+    record_testcase(&record, testcase);
+
+    record_member(&record, ",\"errors\":", result->errors);
+    record_member(&record, ",\"notices\":", result->notices);
+    record_member(&record, ",\"cycles\":", result->cycles);
+
+    if (result->errors != 0)
+    {
+        struct sim65_testcase_result_type expected_values;
+        get_expected_values(testcase, result, &expected_values);
+
+        record_literal(&record, ",\"expected\":");
+        record_values(&record, result->errors, &expected_values);
+        record_literal(&record, ",\"actual\":");
+        record_values(&record, result->errors, result);
+    }
+
+    record_end(&record);
+
+    return (result->errors != 0) ? -1 : 0;
+}
+
+int write_difference_record(const struct sim65_testcase_specification_type * testcase, const struct sim65_difference_type * difference,
+                            const char * filename, unsigned testcase_index, FILE * out)
+{
+    if (difference->differences == 0)
+    {
+        return 0;
+    }
+
+    struct record_buffer_type record;
+
+    record_begin(&record, out, filename);
+    record_member(&record, ",\"index\":", testcase_index);
+    record_testcase(&record, testcase);
+    record_member(&record, ",\"differences\":", difference->differences);
+    record_literal(&record, ",\"sim65\":");
+    record_values(&record, difference->differences, &difference->sim65);
+    record_literal(&record, ",\"reference\":");
+    record_values(&record, difference->differences, &difference->reference);
+    record_end(&record);
+
+    return -1;
+}
+
+void write_parse_error_record(const char * filename, unsigned testcase_index, FILE * out)
+{
+    struct record_buffer_type record;
+
+    record_begin(&record, out, filename);
+    record_member(&record, ",\"index\":", testcase_index);
+    record_literal(&record, ",\"error\":\"parse\"");
+    record_end(&record);
+}
+
+void write_file_summary_record(const char * filename, const struct sim65_file_summary_type * summary, FILE * out)
+{
+    struct record_buffer_type record;
+
+    record_begin(&record, out, filename);
+    record_member(&record, ",\"testcases\":", summary->testcase_count);
+    record_member(&record, ",\"failures\":", summary->failure_count);
+
+    if (summary->differential)
+    {
+        record_literal(&record, ",\"differential\":true");
+    }
+
+    if (summary->skipped)
+    {
+        record_literal(&record, ",\"skipped\":true");
+    }
+
+    if (summary->population != 0)
+    {
+        // The bound is the only value that is not an integer; it is written with six decimals.
+
+        uint64_t bound = summary->failure_rate_bound * 1e6 + 0.5;
+
+        record_member(&record, ",\"population\":", summary->population);
+        record_member(&record, ",\"seed\":", summary->seed);
+        record_member(&record, ",\"failure_rate_bound\":", bound / 1000000);
+        record_char(&record, '.');
+        for (unsigned scale = 100000; scale != 0; scale /= 10)
+        {
+            record_char(&record, '0' + bound / scale % 10);
+        }
+    }
+
+    record_end(&record);
+}
+
+void write_file_error_record(const char * filename, const char * action, FILE * out)
+{
+    struct record_buffer_type record;
+
+    record_begin(&record, out, filename);
+    record_literal(&record, ",\"error\":");
+    record_string(&record, action);
+    record_end(&record);
+}
@@ -0,0 +1,86 @@
+
+/////////////////////
+// sim65-results.h //
+/////////////////////
+
+// Machine-readable test results.
+//
+// With --output-format=jsonl, sim65-test writes one JSON object per line instead of its human-readable log:
+//
+//   {"file":F,"index":I,"name":N,"opcode":O,"errors":E,"notices":M,"cycles":C}
+//
+//       For each test case. E and M are the SIM65_ERROR_* and SIM65_NOTICE_* flags of the outcome, and C is the
+//       cycle count reported by sim65. If E is non-zero, the record also has "expected" and "actual" objects that
+//       hold the values of the failed checks only: "a", "x", "y", "p", "s", "pc", "cycles", "memory", which is
+//       an object with "address" and "value", and "bus", which is an object with the "cycle" (from 1) of the
+//       first differing access, its "type" ("read", "write", or "none"), and unless it is "none", its "address"
+//       and "value". The opcode is omitted if the initial state doesn't define it.
+//
+//   {"file":F,"index":I,"name":N,"opcode":O,"differences":D,"sim65":{...},"reference":{...}}
+//
+//       With --differential, for each test case on which sim65 and the reference core disagree (see
+//       sim65-reference.h), instead of the record above. D holds the SIM65_ERROR_* flags of the values that
+//       differ, and the "sim65" and "reference" objects hold those values, with the same members as "actual".
+//
+//   {"file":F,"index":I,"error":"parse"}
+//
+//       For a test case that cannot be parsed.
+//
+//   {"file":F,"testcases":T,"failures":E}
+//
+//       At the end of each test case file. With --differential, E counts the test cases on which the cores
+//       disagree, and the record has "differential":true. A file that was skipped by --changed-only also has
+//       "skipped":true; a file that was sampled has "population", "seed", and "failure_rate_bound" (see --sample=N).
+//
+//   {"file":F,"error":"process"} or {"file":F,"error":"convert"} or {"file":F,"error":"reconvert"}
+//
+//       For a file that could not be processed or converted. "reconvert" is for a binary test case file that was
+//       converted by an older version of sim65-test, and must be converted again from its JSON file.
+//
+// The records are formatted without printf(), and written with a single fwrite() each, however long they are.
+
+#ifndef SIM65_RESULTS_H
+#define SIM65_RESULTS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "sim65-testcase.h"
+#include "sim65-reference.h"
+
+enum sim65_output_format_type {
+    SIM65_OUTPUT_TEXT,
+    SIM65_OUTPUT_JSONL
+};
+
+struct sim65_file_summary_type
+{
+    unsigned testcase_count;      // Test cases executed.
+    unsigned failure_count;       // Test cases with errors.
+    bool differential;            // Compared with the reference core; failure_count counts the test cases that differ.
+    bool skipped;                 // Not executed; testcase_count is that of the last run that passed.
+    unsigned population;          // If the file was sampled: the number of test cases in the file, otherwise 0.
+    uint64_t seed;                // If the file was sampled: the seed of the sample.
+    double failure_rate_bound;    // If the file was sampled: the upper bound of the failure rate.
+};
+
+// Write the record for the outcome of a test case. Returns -1 if the test case had errors, 0 otherwise.
+int write_testcase_record(const struct sim65_testcase_specification_type * testcase, const struct sim65_testcase_result_type * result,
+                          const char * filename, unsigned testcase_index, FILE * out);
+
+// Write the record for a test case on which sim65 and the reference core disagree; writes nothing if they agree.
+// Returns -1 if they disagree, 0 otherwise.
+int write_difference_record(const struct sim65_testcase_specification_type * testcase, const struct sim65_difference_type * difference,
+                            const char * filename, unsigned testcase_index, FILE * out);
+
+// Write the record for a test case that cannot be parsed.
+void write_parse_error_record(const char * filename, unsigned testcase_index, FILE * out);
+
+// Write the record that summarizes a test case file.
+void write_file_summary_record(const char * filename, const struct sim65_file_summary_type * summary, FILE * out);
+
+// Write the record for a file that could not be handled; the action is "process", "convert" or "reconvert".
+void write_file_error_record(const char * filename, const char * action, FILE * out);
+
+#endif
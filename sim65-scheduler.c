@@ -0,0 +1,404 @@
+
+///////////////////////
+// sim65-scheduler.c //
+///////////////////////
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "sim65-scheduler.h"
+
+// The items are split into chunks. Each thread starts out with an equal share of the chunks in its own queue, and
+// takes chunks from the front of it. A thread that runs out of work steals chunks from the back of the queues of
+// other threads.
+
+#define CHUNK_SIZE 64     // Number of items per chunk.
+
+struct chunk_type
+{
+    unsigned first;           // Index of the first item of the chunk.
+    unsigned count;
+    char * output;
+    size_t output_size;
+    unsigned error_count;
+    int result;
+};
+
+struct chunk_queue_type
+{
+    pthread_mutex_t mutex;
+    unsigned begin;           // The owner of the queue takes chunks from here.
+    unsigned end;             // Other threads steal chunks from here.
+};
+
+struct chunk_pool_type
+{
+    sim65_chunk_function_type run_chunk;
+    void (*thread_exit)(void);
+    void * context;
+
+    struct chunk_type * chunks;
+    unsigned number_of_chunks;
+    struct chunk_queue_type * queues;
+    unsigned number_of_threads;
+};
+
+struct chunk_worker_type
+{
+    struct chunk_pool_type * pool;
+    unsigned thread_index;
+    pthread_t thread;
+};
+
+static void run_chunk(struct chunk_pool_type * pool, struct chunk_type * chunk)
+{
+    FILE * out = open_memstream(&chunk->output, &chunk->output_size);
+    if (out == NULL)
+    {
+        chunk->result = -1; // open_memstream() error.
+        return;
+    }
+
+    chunk->result = pool->run_chunk(pool->context, chunk->first, chunk->count, out, &chunk->error_count);
+
+    if (fclose(out) != 0)
+    {
+        chunk->result = -1;
+    }
+}
+
+static int take_chunk(struct chunk_pool_type * pool, unsigned thread_index)
+{
+    int chunk_index = -1;
+
+    // Take the next chunk from our own queue.
+
+    struct chunk_queue_type * queue = &pool->queues[thread_index];
+
+    pthread_mutex_lock(&queue->mutex);
+    if (queue->begin != queue->end)
+    {
+        chunk_index = queue->begin++;
+    }
+    pthread_mutex_unlock(&queue->mutex);
+
+    // If our queue is empty, steal the last chunk from the queue of another thread.
+
+    for (unsigned i = 1; chunk_index < 0 && i < pool->number_of_threads; ++i)
+    {
+        queue = &pool->queues[(thread_index + i) % pool->number_of_threads];
+
+        pthread_mutex_lock(&queue->mutex);
+        if (queue->begin != queue->end)
+        {
+            chunk_index = --queue->end;
+        }
+        pthread_mutex_unlock(&queue->mutex);
+    }
+
+    return chunk_index;
+}
+
+static void * chunk_worker_thread(void * arg)
+{
+    struct chunk_worker_type * worker = arg;
+
+    int chunk_index;
+    while ((chunk_index = take_chunk(worker->pool, worker->thread_index)) >= 0)
+    {
+        run_chunk(worker->pool, &worker->pool->chunks[chunk_index]);
+    }
+
+    if (worker->thread_index != 0 && worker->pool->thread_exit != NULL)
+    {
+        worker->pool->thread_exit(); // The thread is about to exit.
+    }
+
+    return NULL;
+}
+
+int sim65_run_chunks(unsigned count, unsigned number_of_threads, sim65_chunk_function_type run_chunk, void (*thread_exit)(void),
+                     void * context, unsigned * error_count)
+{
+    int result = 0;
+
+    struct chunk_pool_type pool = { run_chunk, thread_exit, context, NULL, 0, NULL, number_of_threads };
+
+    pool.number_of_chunks = (count + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+    pool.chunks = calloc(pool.number_of_chunks, sizeof(struct chunk_type));
+    pool.queues = calloc(number_of_threads, sizeof(struct chunk_queue_type));
+    struct chunk_worker_type * workers = calloc(number_of_threads, sizeof(struct chunk_worker_type));
+
+    if (pool.chunks == NULL || pool.queues == NULL || workers == NULL)
+    {
+        free(pool.chunks);
+        free(pool.queues);
+        free(workers);
+        return -1; // calloc() error.
+    }
+
+    for (unsigned i = 0; i < pool.number_of_chunks; ++i)
+    {
+        pool.chunks[i].first = i * CHUNK_SIZE;
+        pool.chunks[i].count = (i + 1 < pool.number_of_chunks) ? CHUNK_SIZE : count - i * CHUNK_SIZE;
+    }
+
+    for (unsigned i = 0; i < number_of_threads; ++i)
+    {
+        pthread_mutex_init(&pool.queues[i].mutex, NULL);
+        pool.queues[i].begin = (unsigned)((uint64_t)pool.number_of_chunks * i / number_of_threads);
+        pool.queues[i].end = (unsigned)((uint64_t)pool.number_of_chunks * (i + 1) / number_of_threads);
+    }
+
+    // The calling thread works on the first queue itself.
+
+    unsigned started_threads = 1;
+    while (started_threads < number_of_threads)
+    {
+        workers[started_threads].pool = &pool;
+        workers[started_threads].thread_index = started_threads;
+        if (pthread_create(&workers[started_threads].thread, NULL, chunk_worker_thread, &workers[started_threads]) != 0)
+        {
+            break; // The threads that did start will steal the work of those that didn't.
+        }
+        ++started_threads;
+    }
+
+    workers[0].pool = &pool;
+    workers[0].thread_index = 0;
+    chunk_worker_thread(&workers[0]);
+
+    for (unsigned i = 1; i < started_threads; ++i)
+    {
+        pthread_join(workers[i].thread, NULL);
+    }
+
+    // Threads that failed to start still own a queue; drain it.
+    chunk_worker_thread(&workers[0]);
+
+    // Write the output of the chunks in order, up to and including the first chunk that failed.
+
+    for (unsigned i = 0; i < pool.number_of_chunks; ++i)
+    {
+        struct chunk_type * chunk = &pool.chunks[i];
+
+        if (result == 0)
+        {
+            if (chunk->output_size != 0 && fwrite(chunk->output, 1, chunk->output_size, stdout) != chunk->output_size)
+            {
+                result = -1; // fwrite() error.
+            }
+            *error_count += chunk->error_count;
+            if (chunk->result != 0)
+            {
+                result = -1;
+            }
+        }
+        free(chunk->output);
+    }
+
+    for (unsigned i = 0; i < number_of_threads; ++i)
+    {
+        pthread_mutex_destroy(&pool.queues[i].mutex);
+    }
+
+    free(pool.chunks);
+    free(pool.queues);
+    free(workers);
+
+    return result;
+}
+
+int sim65_copy_output(FILE * output)
+{
+    char buffer[0x10000];
+    size_t size;
+
+    rewind(output);
+    while ((size = fread(buffer, 1, sizeof(buffer), output)) != 0)
+    {
+        if (fwrite(buffer, 1, size, stdout) != size)
+        {
+            return -1; // fwrite() error.
+        }
+    }
+    return ferror(output) ? -1 : 0;
+}
+
+static int run_jobs_serially(unsigned number_of_jobs, sim65_job_function_type run_job, sim65_job_failure_function_type report_job_failure, void * context)
+{
+    for (unsigned i = 0; i < number_of_jobs; ++i)
+    {
+        if (run_job(context, i) != 0)
+        {
+            report_job_failure(context, i);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// To run jobs in parallel, each job is executed in a child process of its own. This is needed because the state
+// of the simulated CPU and its memory are global.
+
+struct job_process_type
+{
+    pid_t pid;
+    FILE * output;
+    bool finished;
+    bool succeeded;
+};
+
+static int run_jobs_in_parallel(unsigned number_of_jobs, unsigned max_processes, sim65_job_function_type run_job,
+                                sim65_job_failure_function_type report_job_failure, void * context)
+{
+    struct job_process_type * processes = calloc(number_of_jobs, sizeof(struct job_process_type));
+    if (processes == NULL)
+    {
+        return -1; // calloc() error.
+    }
+
+    unsigned next_job_to_start = 0;
+    unsigned next_job_to_report = 0;
+    unsigned running_processes = 0;
+    int result = 0;
+
+    while (next_job_to_report < number_of_jobs)
+    {
+        // Start new processes while we have jobs and room for them.
+
+        while (next_job_to_start < number_of_jobs && running_processes < max_processes)
+        {
+            struct job_process_type * process = &processes[next_job_to_start];
+
+            process->output = tmpfile();
+            if (process->output == NULL)
+            {
+                result = -1; // tmpfile() error.
+                break;
+            }
+
+            fflush(stdout); // Don't let the child inherit buffered output.
+
+            process->pid = fork();
+            if (process->pid < 0)
+            {
+                fclose(process->output);
+                process->output = NULL;
+                result = -1; // fork() error.
+                break;
+            }
+
+            if (process->pid == 0)
+            {
+                // This is the child process.
+                if (dup2(fileno(process->output), STDOUT_FILENO) < 0)
+                {
+                    _exit(EXIT_FAILURE);
+                }
+                int job_result = run_job(context, next_job_to_start);
+                fflush(stdout);
+                _exit((job_result == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
+            }
+
+            ++next_job_to_start;
+            ++running_processes;
+        }
+
+        if (result != 0)
+        {
+            break;
+        }
+
+        // Report the output of finished jobs, in order.
+
+        while (next_job_to_report < next_job_to_start && processes[next_job_to_report].finished)
+        {
+            struct job_process_type * process = &processes[next_job_to_report];
+
+            if (sim65_copy_output(process->output) != 0)
+            {
+                result = -1;
+            }
+            fclose(process->output);
+            process->output = NULL;
+
+            if (!process->succeeded)
+            {
+                report_job_failure(context, next_job_to_report);
+                result = -1;
+            }
+
+            ++next_job_to_report;
+
+            if (result != 0)
+            {
+                break;
+            }
+        }
+
+        if (result != 0 || next_job_to_report == number_of_jobs)
+        {
+            break;
+        }
+
+        // Wait for a process to finish.
+
+        int status;
+        pid_t pid = wait(&status);
+        if (pid < 0)
+        {
+            result = -1; // wait() error.
+            break;
+        }
+
+        for (unsigned i = next_job_to_report; i < next_job_to_start; ++i)
+        {
+            if (processes[i].pid == pid && !processes[i].finished)
+            {
+                processes[i].finished = true;
+                processes[i].succeeded = WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+                --running_processes;
+                break;
+            }
+        }
+    }
+
+    // After a failure, stop the processes that are still running; their output is discarded.
+
+    for (unsigned i = next_job_to_report; i < next_job_to_start; ++i)
+    {
+        if (!processes[i].finished)
+        {
+            kill(processes[i].pid, SIGTERM);
+            waitpid(processes[i].pid, NULL, 0);
+        }
+        if (processes[i].output != NULL)
+        {
+            fclose(processes[i].output);
+        }
+    }
+
+    free(processes);
+
+    return result;
+}
+
+int sim65_run_jobs(unsigned number_of_jobs, unsigned max_processes, sim65_job_function_type run_job,
+                   sim65_job_failure_function_type report_job_failure, void * context)
+{
+    if (max_processes > 1 && number_of_jobs > 1)
+    {
+        return run_jobs_in_parallel(number_of_jobs, max_processes, run_job, report_job_failure, context);
+    }
+
+    return run_jobs_serially(number_of_jobs, run_job, report_job_failure, context);
+}
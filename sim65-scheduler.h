@@ -0,0 +1,47 @@
+
+///////////////////////
+// sim65-scheduler.h //
+///////////////////////
+
+// Parallel execution of test cases and test case files.
+//
+// Two levels of parallelism are offered, and both produce exactly the output of a serial run:
+//
+// - The test cases of a file can be executed on several threads (--threads). The test cases are split into
+//   chunks, and the output of each chunk is collected in memory and written in order once all chunks are done.
+//
+// - Test case files (jobs) can be processed in child processes (--jobs). Each child writes its output to an
+//   anonymous temporary file, and the parent copies the outputs to its own output in command line order.
+
+#ifndef SIM65_SCHEDULER_H
+#define SIM65_SCHEDULER_H
+
+#include <stdio.h>
+
+// Execute items [first, first + count) of a chunk, writing their output to 'out', and adding the number of items
+// with errors to *error_count. Returns 0 on success; after a failure, the output of later chunks is discarded.
+typedef int (*sim65_chunk_function_type)(void * context, unsigned first, unsigned count, FILE * out, unsigned * error_count);
+
+// Execute 'count' items on 'number_of_threads' threads, one of which is the calling thread. Each thread has its
+// own simulated CPU, memory and peripherals (see threadlocal.h). The threads that are started call 'thread_exit'
+// (if not NULL) before they exit, to release their thread-local resources.
+// Returns 0 on success, and -1 if a chunk failed or on error.
+int sim65_run_chunks(unsigned count, unsigned number_of_threads, sim65_chunk_function_type run_chunk, void (*thread_exit)(void),
+                     void * context, unsigned * error_count);
+
+// Run job 'job_index', writing its output to stdout. Returns 0 on success.
+typedef int (*sim65_job_function_type)(void * context, unsigned job_index);
+
+// Report on stdout that job 'job_index' failed.
+typedef void (*sim65_job_failure_function_type)(void * context, unsigned job_index);
+
+// Run 'number_of_jobs' jobs in up to 'max_processes' child processes at a time, or in this process if
+// 'max_processes' is 1 or there is a single job. Processing stops at the first job that fails.
+// Returns 0 on success, and -1 if a job failed or on error.
+int sim65_run_jobs(unsigned number_of_jobs, unsigned max_processes, sim65_job_function_type run_job,
+                   sim65_job_failure_function_type report_job_failure, void * context);
+
+// Copy the contents of a file, from the start, to stdout.
+int sim65_copy_output(FILE * output);
+
+#endif
@@ -6,9 +6,33 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <zlib.h>
+#if defined(WITH_ZSTD)
+#include <zstd.h>
+#endif
 
 #include "cJSON.h"
+#include "threadlocal.h"
 #include "sim65-testcase.h"
+#include "sim65-cache.h"
+#include "sim65-corpus.h"
+#include "sim65-fingerprints.h"
+#include "sim65-jsonindex.h"
+#include "sim65-manifest.h"
+#include "sim65-reference.h"
+#include "sim65-results.h"
+#include "sim65-scheduler.h"
 
 static int parse_json_u8_field(cJSON * json_object, char * field_name, uint8_t * value)
 {
@@ -33,213 +57,1945 @@ static int parse_json_u16_field(cJSON * json_object, char * field_name, uint16_t
     cJSON * field = cJSON_GetObjectItemCaseSensitive(json_object, field_name);
     if (!cJSON_IsNumber(field))
     {
-        return -1; // Field not found.
+        return -1; // Field not found.
+    }
+
+    if (field->valueint < 0 || field->valueint > 0xffff)
+    {
+        return -1; // Expecting an unsigned 16-bit value.
+    }
+
+    *value = field->valueint;
+
+    return 0; // Success.
+}
+
+static int parse_json_ram_assignment(cJSON * assignment, uint16_t * address, uint8_t * value)
+{
+    if (!cJSON_IsArray(assignment))
+    {
+        return -1;
+    }
+
+    if (cJSON_GetArraySize(assignment) != 2)
+    {
+        return -1;
+    }
+
+    int address_value = assignment->child->valueint;
+    if (address_value < 0 || address_value > 0xffff)
+    {
+        return -1;
+    }
+
+    int byte_value = assignment->child->next->valueint;
+    if (byte_value < 0 || byte_value > 0xff)
+    {
+        return -1;
+    }
+
+    *address = address_value;
+    *value = byte_value;
+
+    return 0;
+}
+
+static int parse_json_bus_access(cJSON * cycle, struct bus_access_type * access)
+{
+    // Each cycle is described as [address, value, "read"] or [address, value, "write"].
+
+    if (!cJSON_IsArray(cycle) || cJSON_GetArraySize(cycle) != 3)
+    {
+        return -1;
+    }
+
+    int address_value = cycle->child->valueint;
+    if (address_value < 0 || address_value > 0xffff)
+    {
+        return -1;
+    }
+
+    int byte_value = cycle->child->next->valueint;
+    if (byte_value < 0 || byte_value > 0xff)
+    {
+        return -1;
+    }
+
+    const char * type = cJSON_GetStringValue(cycle->child->next->next);
+    if (type == NULL || (strcmp(type, "read") != 0 && strcmp(type, "write") != 0))
+    {
+        return -1;
+    }
+
+    access->address = address_value;
+    access->value = byte_value;
+    access->type = (type[0] == 'w') ? SIM65_BUS_WRITE : SIM65_BUS_READ;
+
+    return 0;
+}
+
+// The RAM assignments and bus accesses of the test case being parsed. Both the initial and final state point into
+// the RAM assignment buffer.
+
+struct testcase_buffer_type
+{
+    struct ram_assignment_type * assignments;
+    size_t size;
+    size_t capacity;
+    struct bus_access_type * bus;
+    size_t bus_capacity;
+};
+
+static int parse_json_machine_state_field(cJSON * json_testcase, char * field_name, struct machine_state_type * state, struct testcase_buffer_type * testcase_buffer)
+{
+    if (!cJSON_IsObject(json_testcase))
+    {
+        return -1;
+    }
+
+    cJSON * json_field = cJSON_GetObjectItemCaseSensitive(json_testcase, field_name);
+
+    if (parse_json_u16_field(json_field, "pc", &state->pc) != 0 ||
+        parse_json_u8_field (json_field, "s" , &state->s ) != 0 ||
+        parse_json_u8_field (json_field, "a" , &state->a ) != 0 ||
+        parse_json_u8_field (json_field, "x" , &state->x ) != 0 ||
+        parse_json_u8_field (json_field, "y" , &state->y ) != 0 ||
+        parse_json_u8_field (json_field, "p" , &state->p ) != 0)
+    {
+        return -1;
+    }
+
+    cJSON * ramspec = cJSON_GetObjectItemCaseSensitive(json_field, "ram");
+    if (!cJSON_IsArray(ramspec))
+    {
+        return -1;
+    }
+
+    // Append the assignments specified in the JSON file to the buffer. The caller sets the state's 'ram'
+    // pointer once all assignments of the test case are in the buffer, as appending may move it.
+
+    size_t ram_size = cJSON_GetArraySize(ramspec);
+
+    if (testcase_buffer->size + ram_size > testcase_buffer->capacity)
+    {
+        size_t new_capacity = testcase_buffer->size + ram_size + 64;
+        struct ram_assignment_type * new_assignments = realloc(testcase_buffer->assignments, new_capacity * sizeof(struct ram_assignment_type));
+        if (new_assignments == NULL)
+        {
+            return -1; // realloc() error.
+        }
+        testcase_buffer->assignments = new_assignments;
+        testcase_buffer->capacity = new_capacity;
+    }
+
+    state->ram_size = 0;
+
+    for (cJSON * assignment = ramspec->child; assignment != NULL; assignment = assignment->next)
+    {
+        struct ram_assignment_type * ram = &testcase_buffer->assignments[testcase_buffer->size];
+
+        if (parse_json_ram_assignment(assignment, &ram->address, &ram->value) != 0)
+        {
+            return -1;
+        }
+
+        ++testcase_buffer->size;
+        ++state->ram_size;
+    }
+    return 0;
+}
+
+// The bus accesses are only parsed if requested; they are only needed to verify the bus activity.
+static int parse_json_testcase(cJSON * json_testcase, struct sim65_testcase_specification_type * testcase, struct testcase_buffer_type * testcase_buffer, bool parse_bus)
+{
+    if (!cJSON_IsObject(json_testcase))
+    {
+        return -1; // We expect an object.
+    }
+
+    cJSON * json_name = cJSON_GetObjectItemCaseSensitive(json_testcase, "name");
+    if (!cJSON_IsString(json_name))
+    {
+        return -1;
+    }
+    testcase->name = json_name->valuestring;
+
+    testcase_buffer->size = 0;
+
+    testcase->initial_state.ram_size = 0;
+    testcase->final_state.ram_size = 0;
+
+    parse_json_machine_state_field(json_testcase, "initial", &testcase->initial_state, testcase_buffer);
+    parse_json_machine_state_field(json_testcase, "final", &testcase->final_state, testcase_buffer);
+
+    testcase->initial_state.ram = testcase_buffer->assignments;
+    testcase->final_state.ram = testcase_buffer->assignments + testcase->initial_state.ram_size;
+
+    cJSON * json_cycles = cJSON_GetObjectItemCaseSensitive(json_testcase, "cycles");
+    if (!cJSON_IsArray(json_cycles))
+    {
+        return -1; // Should be an array.
+    }
+    testcase->cycles = cJSON_GetArraySize(json_cycles);
+    testcase->bus = NULL;
+
+    if (parse_bus)
+    {
+        if (testcase->cycles > testcase_buffer->bus_capacity)
+        {
+            size_t new_capacity = testcase->cycles + 16;
+            struct bus_access_type * new_bus = realloc(testcase_buffer->bus, new_capacity * sizeof(struct bus_access_type));
+            if (new_bus == NULL)
+            {
+                return -1; // realloc() error.
+            }
+            testcase_buffer->bus = new_bus;
+            testcase_buffer->bus_capacity = new_capacity;
+        }
+
+        struct bus_access_type * access = testcase_buffer->bus;
+        for (cJSON * cycle = json_cycles->child; cycle != NULL; cycle = cycle->next)
+        {
+            if (parse_json_bus_access(cycle, access++) != 0)
+            {
+                return -1;
+            }
+        }
+
+        testcase->bus = testcase_buffer->bus;
+    }
+
+    return 0;
+}
+
+static int convert_json_machine_state_field(cJSON * json_testcase, char * field_name, struct sim65_corpus_registers_type * registers)
+{
+    cJSON * json_field = cJSON_GetObjectItemCaseSensitive(json_testcase, field_name);
+
+    memset(registers, 0, sizeof(*registers));
+
+    if (parse_json_u16_field(json_field, "pc", &registers->pc) != 0 ||
+        parse_json_u8_field (json_field, "s" , &registers->s ) != 0 ||
+        parse_json_u8_field (json_field, "a" , &registers->a ) != 0 ||
+        parse_json_u8_field (json_field, "x" , &registers->x ) != 0 ||
+        parse_json_u8_field (json_field, "y" , &registers->y ) != 0 ||
+        parse_json_u8_field (json_field, "p" , &registers->p ) != 0)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int convert_json_ram_field(cJSON * json_testcase, char * field_name, bool is_final, struct sim65_corpus_writer_type * writer)
+{
+    cJSON * json_field = cJSON_GetObjectItemCaseSensitive(json_testcase, field_name);
+
+    cJSON * ramspec = cJSON_GetObjectItemCaseSensitive(json_field, "ram");
+    if (!cJSON_IsArray(ramspec))
+    {
+        return -1;
+    }
+
+    for (cJSON * assignment = ramspec->child; assignment != NULL; assignment = assignment->next)
+    {
+        uint16_t address;
+        uint8_t value;
+
+        if (parse_json_ram_assignment(assignment, &address, &value) != 0 ||
+            sim65_corpus_writer_add_ram_assignment(writer, is_final, address, value) != 0)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int convert_json_testcase(cJSON * json_testcase, struct sim65_corpus_writer_type * writer)
+{
+    if (!cJSON_IsObject(json_testcase))
+    {
+        return -1; // We expect an object.
+    }
+
+    cJSON * json_name = cJSON_GetObjectItemCaseSensitive(json_testcase, "name");
+    if (!cJSON_IsString(json_name))
+    {
+        return -1;
+    }
+
+    struct sim65_corpus_registers_type initial_registers;
+    struct sim65_corpus_registers_type final_registers;
+
+    if (convert_json_machine_state_field(json_testcase, "initial", &initial_registers) != 0 ||
+        convert_json_machine_state_field(json_testcase, "final", &final_registers) != 0)
+    {
+        return -1;
+    }
+
+    cJSON * json_cycles = cJSON_GetObjectItemCaseSensitive(json_testcase, "cycles");
+    if (!cJSON_IsArray(json_cycles))
+    {
+        return -1; // Should be an array.
+    }
+
+    if (sim65_corpus_writer_add_testcase(writer, json_name->valuestring, cJSON_GetArraySize(json_cycles), &initial_registers, &final_registers) != 0 ||
+        convert_json_ram_field(json_testcase, "initial", false, writer) != 0 ||
+        convert_json_ram_field(json_testcase, "final", true, writer) != 0)
+    {
+        return -1;
+    }
+
+    for (cJSON * cycle = json_cycles->child; cycle != NULL; cycle = cycle->next)
+    {
+        struct bus_access_type access;
+
+        if (parse_json_bus_access(cycle, &access) != 0 ||
+            sim65_corpus_writer_add_bus_access(writer, &access) != 0)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// The test case files of the 65x02 project contain a single top-level JSON array holding 10,000 test case objects.
+// Rather than building a cJSON tree for the entire file, we split the top-level array into its elements and
+// parse and execute them one at a time, so memory use does not depend on the number of test cases in the file.
+//
+// Regular files are mapped into memory read-only, and the elements are handed to cJSON directly from the mapping,
+// without copying. Anything that cannot be mapped (e.g., a pipe) is read in fixed-size blocks, and each element
+// is assembled in a separate buffer.
+//
+// Files compressed with gzip (and, if built with WITH_ZSTD, zstd) are recognized by their magic number, and are
+// decompressed block by block as they are read, so the uncompressed text never exists in full.
+
+#define JSON_STREAM_BUFFER_SIZE  0x10000     // Size of the block buffer used to read files that cannot be mapped.
+#define JSON_STREAM_MAX_ELEMENT  0x1000000   // Upper bound on the size of a single array element, in bytes.
+
+enum json_stream_compression_type
+{
+    JSON_STREAM_UNCOMPRESSED,
+    JSON_STREAM_GZIP,
+    JSON_STREAM_ZSTD
+};
+
+struct json_array_stream_type
+{
+    int fd;
+    enum json_stream_compression_type compression;
+    char * input;             // Compressed input, if the file is compressed.
+    size_t input_position;
+    size_t input_size;
+    bool input_end;           // Set if the compressed input ends at the end of a gzip member or zstd frame.
+    z_stream gzip_stream;
+#if defined(WITH_ZSTD)
+    ZSTD_DStream * zstd_stream;
+#endif
+    void * mapping;           // The mapped file, or NULL if the file is read in blocks.
+    size_t mapping_size;
+    char * block;             // Block buffer, if the file is read in blocks.
+    const char * buffer;      // Either the mapping, or the block buffer.
+    size_t buffer_position;
+    size_t buffer_size;
+    unsigned element_count;   // Number of array elements returned so far.
+    const char * element;     // Text of the most recently returned array element.
+    size_t element_size;
+    char * element_buffer;    // Holds the element text, if the file is read in blocks.
+    size_t element_capacity;
+    sim65_json_classifier_type classify;  // Used to find structural characters in a mapped file.
+    size_t index_block;                   // Position of the most recently classified block.
+    uint64_t index_mask;                  // Structural characters in that block.
+};
+
+static ssize_t json_array_stream_read(int fd, char * buffer)
+{
+    ssize_t read_result;
+    do
+    {
+        read_result = read(fd, buffer, JSON_STREAM_BUFFER_SIZE);
+    }
+    while (read_result < 0 && errno == EINTR);
+
+    return read_result;
+}
+
+// Decompress the next part of a compressed file into the block buffer.
+// Returns the number of bytes produced, 0 at the end of the file, and -1 on error.
+static ssize_t json_array_stream_decompress(struct json_array_stream_type * stream)
+{
+    for (;;)
+    {
+        if (stream->input_position == stream->input_size)
+        {
+            ssize_t read_result = json_array_stream_read(stream->fd, stream->input);
+            if (read_result <= 0)
+            {
+                // End of file, or read() error. A file that ends in the middle of a gzip member or zstd frame is truncated.
+                return (read_result == 0 && stream->input_end) ? 0 : -1;
+            }
+            stream->input_position = 0;
+            stream->input_size = read_result;
+        }
+
+        size_t output_size;
+
+        if (stream->compression == JSON_STREAM_GZIP)
+        {
+            z_stream * gzip_stream = &stream->gzip_stream;
+
+            gzip_stream->next_in = (Bytef *)stream->input + stream->input_position;
+            gzip_stream->avail_in = stream->input_size - stream->input_position;
+            gzip_stream->next_out = (Bytef *)stream->block;
+            gzip_stream->avail_out = JSON_STREAM_BUFFER_SIZE;
+
+            size_t input_position = stream->input_position;
+
+            int inflate_result = inflate(gzip_stream, Z_NO_FLUSH);
+
+            stream->input_position = stream->input_size - gzip_stream->avail_in;
+            output_size = JSON_STREAM_BUFFER_SIZE - gzip_stream->avail_out;
+
+            if (inflate_result == Z_STREAM_END)
+            {
+                // A gzip file may consist of several members; prepare for the next one.
+                stream->input_end = true;
+                if (inflateReset(gzip_stream) != Z_OK)
+                {
+                    return -1;
+                }
+            }
+            else if (inflate_result == Z_OK || inflate_result == Z_BUF_ERROR)
+            {
+                if (stream->input_position != input_position || output_size != 0)
+                {
+                    stream->input_end = false; // We are inside a gzip member.
+                }
+            }
+            else
+            {
+                return -1; // Corrupt data.
+            }
+        }
+        else
+        {
+#if defined(WITH_ZSTD)
+            ZSTD_inBuffer zstd_input = { stream->input, stream->input_size, stream->input_position };
+            ZSTD_outBuffer zstd_output = { stream->block, JSON_STREAM_BUFFER_SIZE, 0 };
+
+            size_t zstd_result = ZSTD_decompressStream(stream->zstd_stream, &zstd_output, &zstd_input);
+            if (ZSTD_isError(zstd_result))
+            {
+                return -1; // Corrupt data.
+            }
+
+            stream->input_position = zstd_input.pos;
+            stream->input_end = (zstd_result == 0); // A frame has been completed.
+            output_size = zstd_output.pos;
+#else
+            return -1; // Not supported.
+#endif
+        }
+
+        if (output_size != 0)
+        {
+            return output_size;
+        }
+    }
+}
+
+static int json_array_stream_peek(struct json_array_stream_type * stream)
+{
+    if (stream->buffer_position == stream->buffer_size)
+    {
+        if (stream->mapping != NULL)
+        {
+            return EOF;
+        }
+
+        ssize_t read_result;
+        if (stream->compression == JSON_STREAM_UNCOMPRESSED)
+        {
+            read_result = json_array_stream_read(stream->fd, stream->block);
+        }
+        else
+        {
+            read_result = json_array_stream_decompress(stream);
+        }
+
+        if (read_result <= 0)
+        {
+            return EOF; // End of file, or read() error.
+        }
+
+        stream->buffer_position = 0;
+        stream->buffer_size = read_result;
+    }
+    return (unsigned char)stream->buffer[stream->buffer_position];
+}
+
+static int json_array_stream_skip_whitespace(struct json_array_stream_type * stream)
+{
+    int c;
+    while ((c = json_array_stream_peek(stream)) == ' ' || c == '\t' || c == '\n' || c == '\r')
+    {
+        ++stream->buffer_position;
+    }
+    return c;
+}
+
+static int json_array_stream_append(struct json_array_stream_type * stream, char c)
+{
+    if (stream->element_size == stream->element_capacity)
+    {
+        if (stream->element_capacity >= JSON_STREAM_MAX_ELEMENT)
+        {
+            return -1; // Array element too big.
+        }
+
+        size_t new_capacity = (stream->element_capacity == 0) ? 0x1000 : 2 * stream->element_capacity;
+        char * new_element = realloc(stream->element_buffer, new_capacity);
+        if (new_element == NULL)
+        {
+            return -1; // realloc() error.
+        }
+        stream->element_buffer = new_element;
+        stream->element_capacity = new_capacity;
+    }
+    stream->element_buffer[stream->element_size++] = c;
+    return 0;
+}
+
+static void json_array_stream_close(struct json_array_stream_type * stream)
+{
+    if (stream->mapping != NULL)
+    {
+        munmap(stream->mapping, stream->mapping_size);
+        stream->mapping = NULL;
+    }
+    if (stream->compression == JSON_STREAM_GZIP)
+    {
+        inflateEnd(&stream->gzip_stream);
+    }
+#if defined(WITH_ZSTD)
+    if (stream->compression == JSON_STREAM_ZSTD)
+    {
+        ZSTD_freeDStream(stream->zstd_stream);
+    }
+#endif
+    stream->compression = JSON_STREAM_UNCOMPRESSED;
+    free(stream->input);
+    stream->input = NULL;
+    free(stream->block);
+    stream->block = NULL;
+    free(stream->element_buffer);
+    stream->element_buffer = NULL;
+    close(stream->fd);
+}
+
+// Determine the compression of a file from the first bytes of its contents.
+static enum json_stream_compression_type json_stream_compression(const unsigned char * data, size_t size)
+{
+    if (size >= 2 && data[0] == 0x1f && data[1] == 0x8b)
+    {
+        return JSON_STREAM_GZIP;
+    }
+    if (size >= 4 && data[0] == 0x28 && data[1] == 0xb5 && data[2] == 0x2f && data[3] == 0xfd)
+    {
+        return JSON_STREAM_ZSTD;
+    }
+    return JSON_STREAM_UNCOMPRESSED;
+}
+
+static int json_array_stream_open(struct json_array_stream_type * stream, const char * filename)
+{
+    memset(stream, 0, sizeof(*stream));
+
+    stream->fd = open(filename, O_RDONLY);
+    if (stream->fd < 0)
+    {
+        return -1; // Cannot open file.
+    }
+
+    struct stat st;
+    if (fstat(stream->fd, &st) != 0)
+    {
+        close(stream->fd);
+        return -1; // fstat() error.
+    }
+
+    // Look at the first bytes of the file to see if it is compressed. If the file is not a regular file, we
+    // cannot go back to the start, so the bytes are read into the block buffer and are used from there.
+
+    unsigned char magic[4];
+    ssize_t magic_size;
+    size_t preread_size = 0;
+
+    if (S_ISREG(st.st_mode))
+    {
+        magic_size = pread(stream->fd, magic, sizeof(magic), 0);
+    }
+    else
+    {
+        stream->block = malloc(JSON_STREAM_BUFFER_SIZE);
+        if (stream->block == NULL)
+        {
+            close(stream->fd);
+            return -1; // malloc() error.
+        }
+
+        magic_size = json_array_stream_read(stream->fd, stream->block);
+        if (magic_size > 0)
+        {
+            preread_size = magic_size;
+            memcpy(magic, stream->block, (preread_size < sizeof(magic)) ? preread_size : sizeof(magic));
+        }
+    }
+
+    if (magic_size < 0)
+    {
+        json_array_stream_close(stream);
+        return -1; // read() error.
+    }
+
+    stream->compression = json_stream_compression(magic, ((size_t)magic_size < sizeof(magic)) ? (size_t)magic_size : sizeof(magic));
+
+    if (stream->compression != JSON_STREAM_UNCOMPRESSED)
+    {
+        stream->input = malloc(JSON_STREAM_BUFFER_SIZE);
+        if (stream->input == NULL)
+        {
+            stream->compression = JSON_STREAM_UNCOMPRESSED;
+            json_array_stream_close(stream);
+            return -1; // malloc() error.
+        }
+
+        // Bytes that have already been read are compressed input.
+
+        if (preread_size != 0)
+        {
+            memcpy(stream->input, stream->block, preread_size);
+            stream->input_size = preread_size;
+        }
+
+        bool initialized = false;
+
+        if (stream->compression == JSON_STREAM_GZIP)
+        {
+            // A window size of 15 + 16 selects the gzip format rather than the zlib format.
+            initialized = (inflateInit2(&stream->gzip_stream, 15 + 16) == Z_OK);
+        }
+#if defined(WITH_ZSTD)
+        else
+        {
+            stream->zstd_stream = ZSTD_createDStream();
+            initialized = (stream->zstd_stream != NULL);
+        }
+#endif
+
+        if (!initialized)
+        {
+            stream->compression = JSON_STREAM_UNCOMPRESSED;
+            json_array_stream_close(stream);
+            return -1; // Decompressor error, or zstd support not built in.
+        }
+    }
+    else if (preread_size != 0)
+    {
+        stream->buffer_size = preread_size;
+    }
+
+    if (stream->compression == JSON_STREAM_UNCOMPRESSED && S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        void * mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, stream->fd, 0);
+        if (mapping != MAP_FAILED)
+        {
+            // The file is read front to back exactly once; let the kernel read ahead aggressively.
+            madvise(mapping, st.st_size, MADV_SEQUENTIAL);
+
+            stream->mapping = mapping;
+            stream->mapping_size = st.st_size;
+            stream->buffer = mapping;
+            stream->buffer_size = st.st_size;
+            stream->classify = sim65_json_select_classifier();
+            stream->index_block = SIZE_MAX;
+        }
+    }
+
+    if (stream->mapping == NULL)
+    {
+        if (stream->block == NULL)
+        {
+            stream->block = malloc(JSON_STREAM_BUFFER_SIZE);
+            if (stream->block == NULL)
+            {
+                json_array_stream_close(stream);
+                return -1; // malloc() error.
+            }
+        }
+        stream->buffer = stream->block;
+    }
+
+    if (json_array_stream_skip_whitespace(stream) != '[')
+    {
+        json_array_stream_close(stream);
+        return -1; // We expect an array.
+    }
+    ++stream->buffer_position;
+
+    return 0;
+}
+
+// Copy the element that starts at the current position into stream->element_buffer, one character at a time.
+static int json_array_stream_copy_element(struct json_array_stream_type * stream)
+{
+    unsigned depth = 0;
+    bool in_string = false;
+    bool escape = false;
+
+    for (;;)
+    {
+        int c = json_array_stream_peek(stream);
+        if (c == EOF)
+        {
+            return -1; // Unexpected end of file.
+        }
+
+        if (in_string)
+        {
+            if (escape)
+            {
+                escape = false;
+            }
+            else if (c == '\\')
+            {
+                escape = true;
+            }
+            else if (c == '"')
+            {
+                in_string = false;
+            }
+        }
+        else if (c == '"')
+        {
+            in_string = true;
+        }
+        else if (c == '{' || c == '[')
+        {
+            ++depth;
+        }
+        else if (c == '}' || c == ']' || c == ',')
+        {
+            if (depth == 0)
+            {
+                break; // End of a scalar element; leave the delimiter for the next call.
+            }
+            if (c != ',')
+            {
+                --depth;
+            }
+        }
+
+        if (json_array_stream_append(stream, c) != 0)
+        {
+            return -1;
+        }
+        ++stream->buffer_position;
+
+        if (depth == 0 && !in_string && (c == '}' || c == ']'))
+        {
+            break; // End of an object or array element.
+        }
+    }
+
+
+    return 0;
+}
+
+// Find the position of the first structural character at or after the given position in a mapped file,
+// or the size of the file if there is none.
+static size_t json_array_stream_next_structural(struct json_array_stream_type * stream, size_t position)
+{
+    size_t block = position - position % SIM65_JSON_BLOCK_SIZE;
+
+    while (block < stream->buffer_size)
+    {
+        if (block != stream->index_block)
+        {
+            if (stream->buffer_size - block >= SIM65_JSON_BLOCK_SIZE)
+            {
+                stream->index_mask = stream->classify(stream->buffer + block);
+            }
+            else
+            {
+                // The last block of the file is padded with zeros, which are not structural.
+                char padded_block[SIM65_JSON_BLOCK_SIZE] = { 0 };
+                memcpy(padded_block, stream->buffer + block, stream->buffer_size - block);
+                stream->index_mask = stream->classify(padded_block);
+            }
+            stream->index_block = block;
+        }
+
+        uint64_t mask = stream->index_mask & (~(uint64_t)0 << (position - block));
+        if (mask != 0)
+        {
+            return block + __builtin_ctzll(mask);
+        }
+
+        block += SIM65_JSON_BLOCK_SIZE;
+        position = block;
+    }
+
+    return stream->buffer_size;
+}
+
+// Find the end of the element that starts at the current position in a mapped file. This does the same as
+// json_array_stream_copy_element(), but only visits the structural characters of the element.
+static int json_array_stream_skip_element(struct json_array_stream_type * stream)
+{
+    unsigned depth = 0;
+    bool in_string = false;
+    size_t escaped_position = SIZE_MAX; // Position of the character following a backslash in a string.
+
+    size_t position = stream->buffer_position;
+
+    for (;;)
+    {
+        position = json_array_stream_next_structural(stream, position);
+        if (position == stream->buffer_size)
+        {
+            return -1; // Unexpected end of file.
+        }
+
+        char c = stream->buffer[position];
+
+        if (in_string)
+        {
+            if (position == escaped_position)
+            {
+                // Escaped character.
+            }
+            else if (c == '\\')
+            {
+                escaped_position = position + 1;
+            }
+            else if (c == '"')
+            {
+                in_string = false;
+            }
+        }
+        else if (c == '"')
+        {
+            in_string = true;
+        }
+        else if (c == '{' || c == '[')
+        {
+            ++depth;
+        }
+        else if (c == '}' || c == ']' || c == ',')
+        {
+            if (depth == 0)
+            {
+                break; // End of a scalar element; leave the delimiter for the next call.
+            }
+            if (c != ',' && --depth == 0)
+            {
+                ++position;
+                break; // End of an object or array element.
+            }
+        }
+
+        ++position;
+    }
+
+    stream->buffer_position = position;
+    return 0;
+}
+
+// Read the next element of the top-level array into stream->element.
+// Returns 1 if an element was read, 0 at the end of the array, and -1 on error.
+static int json_array_stream_next(struct json_array_stream_type * stream)
+{
+    int c = json_array_stream_skip_whitespace(stream);
+
+    if (c == ']')
+    {
+        ++stream->buffer_position;
+        return 0; // End of array.
+    }
+
+    if (stream->element_count != 0)
+    {
+        if (c != ',')
+        {
+            return -1; // Expected an element separator.
+        }
+        ++stream->buffer_position;
+        c = json_array_stream_skip_whitespace(stream);
+    }
+
+    // Find the end of the element. We only need to track nesting depth and strings to find where it ends;
+    // validating the element's contents is left to cJSON.
+
+    stream->element_size = 0;
+
+    size_t element_position = stream->buffer_position;
+
+    int result = (stream->mapping != NULL) ? json_array_stream_skip_element(stream) : json_array_stream_copy_element(stream);
+    if (result != 0)
+    {
+        return -1;
+    }
+
+    if (stream->mapping != NULL)
+    {
+        stream->element = stream->buffer + element_position;
+        stream->element_size = stream->buffer_position - element_position;
+    }
+    else
+    {
+        stream->element = stream->element_buffer;
+    }
+
+    if (stream->element_size == 0)
+    {
+        return -1; // Empty element.
+    }
+
+    ++stream->element_count;
+    return 1;
+}
+
+// Parsing a test case creates thousands of small cJSON nodes and strings, all of which are discarded together
+// once the test case has been handled. Instead of allocating and freeing each of them separately, cJSON is
+// configured (see cJSON_InitHooks() in main) to take its memory from an arena. Allocation just advances a pointer
+// through a list of large blocks; freeing individual nodes does nothing. After each test case, the arena is reset
+// to its first block, and the blocks are reused for the next test case, and for the next file.
+//
+// Each thread has its own arena, so this also works when test cases are executed on several threads.
+
+#define JSON_ARENA_BLOCK_SIZE  0x100000
+
+struct json_arena_block_type
+{
+    struct json_arena_block_type * next;
+    size_t size;
+    size_t used;
+    max_align_t data[];
+};
+
+struct json_arena_type
+{
+    struct json_arena_block_type * first;
+    struct json_arena_block_type * current;
+};
+
+static SIM65_THREAD_LOCAL struct json_arena_type json_arena;
+
+static void * json_arena_allocate(size_t size)
+{
+    size = (size + sizeof(max_align_t) - 1) / sizeof(max_align_t) * sizeof(max_align_t);
+
+    struct json_arena_block_type * block = json_arena.current;
+
+    // Move on to the next block if the current block is full. Blocks that are too small for the request are
+    // skipped; that can only happen for very large strings.
+
+    while (block != NULL && block->size - block->used < size)
+    {
+        block = block->next;
+        if (block != NULL)
+        {
+            block->used = 0;
+        }
+    }
+
+    if (block == NULL)
+    {
+        size_t block_size = (size > JSON_ARENA_BLOCK_SIZE) ? size : JSON_ARENA_BLOCK_SIZE;
+
+        block = malloc(sizeof(struct json_arena_block_type) + block_size);
+        if (block == NULL)
+        {
+            return NULL; // malloc() error.
+        }
+        block->size = block_size;
+        block->used = 0;
+
+        // Insert the new block after the current one, so the blocks that follow it can still be reused.
+
+        if (json_arena.current == NULL)
+        {
+            block->next = json_arena.first;
+            json_arena.first = block;
+        }
+        else
+        {
+            block->next = json_arena.current->next;
+            json_arena.current->next = block;
+        }
+    }
+
+    json_arena.current = block;
+
+    void * result = (char *)block->data + block->used;
+    block->used += size;
+    return result;
+}
+
+static void json_arena_deallocate(void * pointer)
+{
+    (void)pointer; // Memory is reclaimed by json_arena_reset().
+}
+
+// Discard everything allocated from the arena of the calling thread, keeping its blocks for reuse.
+static void json_arena_reset(void)
+{
+    json_arena.current = json_arena.first;
+    if (json_arena.current != NULL)
+    {
+        json_arena.current->used = 0;
+    }
+}
+
+// Release the blocks of the arena of the calling thread.
+static void json_arena_free(void)
+{
+    while (json_arena.first != NULL)
+    {
+        struct json_arena_block_type * next = json_arena.first->next;
+        free(json_arena.first);
+        json_arena.first = next;
+    }
+    json_arena.current = NULL;
+}
+
+// The format of everything sim65-test writes to stdout about test results. It is set once, before any test case
+// file is processed.
+
+static enum sim65_output_format_type output_format = SIM65_OUTPUT_TEXT;
+
+static int report_testcase(const struct sim65_testcase_specification_type * testcase, const struct sim65_testcase_result_type * result,
+                           const char * filename, unsigned testcase_index, FILE * out)
+{
+    if (output_format == SIM65_OUTPUT_JSONL)
+    {
+        return write_testcase_record(testcase, result, filename, testcase_index, out);
+    }
+    return report_testcase_result(testcase, result, filename, testcase_index, out);
+}
+
+static int report_difference(const struct sim65_testcase_specification_type * testcase, const struct sim65_difference_type * difference,
+                             const char * filename, unsigned testcase_index, FILE * out)
+{
+    if (output_format == SIM65_OUTPUT_JSONL)
+    {
+        return write_difference_record(testcase, difference, filename, testcase_index, out);
+    }
+    return report_differential_result(testcase, difference, filename, testcase_index, out);
+}
+
+// Execute up to EXECUTE_BATCH_SIZE test cases as a batch, and report their outcome. With F_TEST_DIFFERENTIAL, the
+// test cases are executed on both sim65 and the reference core instead, and only the test cases on which they
+// disagree are reported. Returns the number of test cases with errors, or on which the cores disagree.
+
+#define EXECUTE_BATCH_SIZE 64
+
+static unsigned run_testcases(const struct sim65_testcase_specification_type * testcases, const unsigned * testcase_indices, unsigned count,
+                              const char * filename, enum sim65_cpu_mode_type cpu_mode, unsigned test_flags, FILE * out)
+{
+    unsigned testcase_error = 0;
+
+    if (test_flags & F_TEST_DIFFERENTIAL)
+    {
+        struct sim65_difference_type differences[EXECUTE_BATCH_SIZE];
+
+        execute_differential_batch(testcases, count, cpu_mode, test_flags, differences);
+
+        for (unsigned i = 0; i < count; ++i)
+        {
+            if (report_difference(&testcases[i], &differences[i], filename, testcase_indices[i], out) != 0)
+            {
+                ++testcase_error;
+            }
+        }
+    }
+    else
+    {
+        struct sim65_testcase_result_type results[EXECUTE_BATCH_SIZE];
+
+        execute_testcase_batch(testcases, count, cpu_mode, test_flags, results);
+
+        for (unsigned i = 0; i < count; ++i)
+        {
+            if (report_testcase(&testcases[i], &results[i], filename, testcase_indices[i], out) != 0)
+            {
+                ++testcase_error;
+            }
+        }
+    }
+
+    return testcase_error;
+}
+
+static void report_file_summary(const char * filename, const struct sim65_file_summary_type * summary)
+{
+    if (output_format == SIM65_OUTPUT_JSONL)
+    {
+        write_file_summary_record(filename, summary, stdout);
+    }
+    else if (summary->skipped)
+    {
+        printf("[%s] INFO - Test file summary: 0 of %u testcases show deviations from expected behavior (not executed: unchanged since it last passed).\n",
+               filename, summary->testcase_count);
+    }
+    else
+    {
+        printf("[%s] INFO - Test file summary: %u of %u testcases %s.\n", filename, summary->failure_count, summary->testcase_count,
+               summary->differential ? "differ between sim65 and the reference core" : "show deviations from expected behavior");
+
+        if (summary->population != 0)
+        {
+            printf("[%s] INFO - Sample summary: %u of %u testcases executed (seed %llu); failure rate is at most %.2f%% (95%% confidence).\n",
+                   filename, summary->testcase_count, summary->population, (unsigned long long)summary->seed, 100.0 * summary->failure_rate_bound);
+        }
+    }
+}
+
+// Parse and execute a single JSON test case. Returns -1 if the text is not valid JSON.
+static int run_json_testcase(const char * text, size_t size, const char * filename, unsigned testcase_index, enum sim65_cpu_mode_type cpu_mode, unsigned test_flags,
+                             struct testcase_buffer_type * testcase_buffer, FILE * out, unsigned * testcase_error)
+{
+    cJSON * json_testcase = cJSON_ParseWithLength(text, size);
+    if (json_testcase == NULL)
+    {
+        json_arena_reset();
+        return -1; // JSON parse error.
+    }
+
+    struct sim65_testcase_specification_type testcase;
+
+    int result = parse_json_testcase(json_testcase, &testcase, testcase_buffer, (test_flags & F_TEST_BUS) != 0);
+    if (result != 0)
+    {
+        if (output_format == SIM65_OUTPUT_JSONL)
+        {
+            write_parse_error_record(filename, testcase_index, out);
+        }
+        else
+        {
+            fprintf(out, "[%s:%u] ERROR: Testcase cannot be parsed.\n", filename, testcase_index);
+        }
+    }
+    else
+    {
+        *testcase_error += run_testcases(&testcase, &testcase_index, 1, filename, cpu_mode, test_flags, out);
+    }
+
+    json_arena_reset(); // Discards json_testcase.
+
+    return 0;
+}
+
+static void get_corpus_testcase(const struct sim65_corpus_type * corpus, uint32_t i, struct sim65_testcase_specification_type * testcase)
+{
+    const struct sim65_corpus_testcase_type * record = &corpus->testcases[i];
+
+    testcase->name = corpus->names + record->name_offset;
+
+    testcase->initial_state.pc = record->initial_registers.pc;
+    testcase->initial_state.s  = record->initial_registers.s;
+    testcase->initial_state.a  = record->initial_registers.a;
+    testcase->initial_state.x  = record->initial_registers.x;
+    testcase->initial_state.y  = record->initial_registers.y;
+    testcase->initial_state.p  = record->initial_registers.p;
+    testcase->initial_state.ram_size = record->initial_ram_count;
+    testcase->initial_state.ram = &corpus->ram_assignments[record->ram_index];
+
+    testcase->final_state.pc = record->final_registers.pc;
+    testcase->final_state.s  = record->final_registers.s;
+    testcase->final_state.a  = record->final_registers.a;
+    testcase->final_state.x  = record->final_registers.x;
+    testcase->final_state.y  = record->final_registers.y;
+    testcase->final_state.p  = record->final_registers.p;
+    testcase->final_state.ram_size = record->final_ram_count;
+    testcase->final_state.ram = &corpus->ram_assignments[record->ram_index + record->initial_ram_count];
+
+    testcase->cycles = record->cycles;
+    testcase->bus = &corpus->bus_accesses[record->bus_index];
+}
+
+// Execute a range of test cases from a binary test case file, and report their outcome. The test cases of a
+// binary file are all available in memory, so they are executed in batches (see execute_testcase_batch()).
+// Returns the number of test cases with errors.
+
+static unsigned run_corpus_testcases(const struct sim65_corpus_type * corpus, uint32_t first, uint32_t count,
+                                     const char * filename, enum sim65_cpu_mode_type cpu_mode, unsigned test_flags, FILE * out)
+{
+    struct sim65_testcase_specification_type testcases[EXECUTE_BATCH_SIZE];
+    unsigned testcase_indices[EXECUTE_BATCH_SIZE];
+
+    unsigned testcase_error = 0;
+
+    for (uint32_t i = 0; i < count; i += EXECUTE_BATCH_SIZE)
+    {
+        unsigned batch_size = (count - i < EXECUTE_BATCH_SIZE) ? count - i : EXECUTE_BATCH_SIZE;
+
+        for (unsigned j = 0; j < batch_size; ++j)
+        {
+            get_corpus_testcase(corpus, first + i + j, &testcases[j]);
+            testcase_indices[j] = first + i + j + 1;
+        }
+
+        testcase_error += run_testcases(testcases, testcase_indices, batch_size, filename, cpu_mode, test_flags, out);
+    }
+
+    return testcase_error;
+}
+
+// To execute the test cases of a file on several threads, a batch of consecutive test cases is handed to the
+// scheduler (see sim65-scheduler.h), which splits it into chunks.
+
+#define TESTCASE_BATCH_SIZE   4096   // Maximum number of JSON test cases read ahead from a file.
+
+struct testcase_batch_type
+{
+    const char * filename;
+    enum sim65_cpu_mode_type cpu_mode;
+    unsigned test_flags;
+    unsigned first_testcase_index;  // Test case index (starting at 1) of the first test case in the batch.
+    unsigned testcase_count;
+
+    // The test cases come either from a binary test case file, or from the texts of JSON test cases.
+    // The text of JSON test case i of the batch starts at json_text[json_offsets[i]] and is json_sizes[i] bytes long.
+    const struct sim65_corpus_type * corpus;
+    const char * json_text;
+    const size_t * json_offsets;
+    const size_t * json_sizes;
+
+    unsigned number_of_threads;
+};
+
+static int run_testcase_chunk(void * context, unsigned first, unsigned count, FILE * out, unsigned * testcase_error)
+{
+    const struct testcase_batch_type * batch = context;
+
+    if (batch->corpus != NULL)
+    {
+        *testcase_error += run_corpus_testcases(batch->corpus, batch->first_testcase_index - 1 + first, count,
+                                                batch->filename, batch->cpu_mode, batch->test_flags, out);
+        return 0;
+    }
+
+    int result = 0;
+
+    struct testcase_buffer_type testcase_buffer = { NULL, 0, 0, NULL, 0 };
+
+    for (unsigned i = first; i < first + count; ++i)
+    {
+        unsigned testcase_index = batch->first_testcase_index + i;
+
+        const char * text = batch->json_text + batch->json_offsets[i];
+        size_t size = batch->json_sizes[i];
+
+        if (run_json_testcase(text, size, batch->filename, testcase_index, batch->cpu_mode, batch->test_flags, &testcase_buffer, out, testcase_error) != 0)
+        {
+            result = -1; // Malformed test case; the test cases after it are not executed.
+            break;
+        }
+    }
+
+    free(testcase_buffer.assignments);
+    free(testcase_buffer.bus);
+
+    return result;
+}
+
+static int run_testcase_batch(struct testcase_batch_type * batch, unsigned * testcase_error)
+{
+    return sim65_run_chunks(batch->testcase_count, batch->number_of_threads, run_testcase_chunk, json_arena_free, batch, testcase_error);
+}
+
+static int process_testcase_stream(const char * filename, enum sim65_cpu_mode_type cpu_mode, unsigned test_flags, unsigned number_of_threads,
+                                   struct sim65_file_summary_type * summary)
+{
+    struct json_array_stream_type * stream = malloc(sizeof(struct json_array_stream_type));
+    if (stream == NULL)
+    {
+        return -1; // malloc() error.
+    }
+
+    if (json_array_stream_open(stream, filename) != 0)
+    {
+        free(stream);
+        return -1; // Cannot open file, or not an array.
+    }
+
+    struct testcase_buffer_type testcase_buffer = { NULL, 0, 0, NULL, 0 };
+
+    unsigned testcase_index = 0; // First testcase will be 1, and so on.
+    unsigned testcase_error = 0;
+
+    int next_result;
+
+    if (number_of_threads <= 1)
+    {
+        // Execute each test case as soon as it has been read.
+        while ((next_result = json_array_stream_next(stream)) > 0)
+        {
+            ++testcase_index;
+
+            if (run_json_testcase(stream->element, stream->element_size, filename, testcase_index, cpu_mode, test_flags, &testcase_buffer, stdout, &testcase_error) != 0)
+            {
+                next_result = -1; // JSON parse error.
+                break;
+            }
+        }
+    }
+    else
+    {
+        // Read a batch of test case texts, execute the batch in parallel, and repeat.
+        // The texts of a mapped file are used in place; otherwise, they are copied into a buffer.
+
+        char * batch_text = NULL;
+        size_t batch_text_size = 0;
+        size_t batch_text_capacity = 0;
+        size_t batch_offsets[TESTCASE_BATCH_SIZE];
+        size_t batch_sizes[TESTCASE_BATCH_SIZE];
+
+        do
+        {
+            struct testcase_batch_type batch;
+
+            memset(&batch, 0, sizeof(batch));
+            batch.filename = filename;
+            batch.cpu_mode = cpu_mode;
+            batch.test_flags = test_flags;
+            batch.first_testcase_index = testcase_index + 1;
+            batch.number_of_threads = number_of_threads;
+
+            batch_text_size = 0;
+
+            while (batch.testcase_count < TESTCASE_BATCH_SIZE && (next_result = json_array_stream_next(stream)) > 0)
+            {
+                batch_sizes[batch.testcase_count] = stream->element_size;
+
+                if (stream->mapping != NULL)
+                {
+                    batch_offsets[batch.testcase_count++] = stream->element - stream->buffer;
+                    continue;
+                }
+
+                if (batch_text_size + stream->element_size > batch_text_capacity)
+                {
+                    size_t new_capacity = 2 * (batch_text_size + stream->element_size);
+                    char * new_text = realloc(batch_text, new_capacity);
+                    if (new_text == NULL)
+                    {
+                        next_result = -1; // realloc() error.
+                        break;
+                    }
+                    batch_text = new_text;
+                    batch_text_capacity = new_capacity;
+                }
+
+                memcpy(batch_text + batch_text_size, stream->element, stream->element_size);
+                batch_offsets[batch.testcase_count++] = batch_text_size;
+                batch_text_size += stream->element_size;
+            }
+
+            if (batch.testcase_count != 0)
+            {
+                batch.json_text = (stream->mapping != NULL) ? stream->buffer : batch_text;
+                batch.json_offsets = batch_offsets;
+                batch.json_sizes = batch_sizes;
+
+                if (run_testcase_batch(&batch, &testcase_error) != 0)
+                {
+                    next_result = -1;
+                }
+
+                testcase_index += batch.testcase_count;
+            }
+        }
+        while (next_result > 0);
+
+        free(batch_text);
+    }
+
+    free(testcase_buffer.assignments);
+    free(testcase_buffer.bus);
+
+    json_array_stream_close(stream);
+    free(stream);
+
+    if (next_result != 0)
+    {
+        return -1; // Malformed test case file.
+    }
+
+    *summary = (struct sim65_file_summary_type) { .testcase_count = testcase_index, .failure_count = testcase_error,
+                                                  .differential = (test_flags & F_TEST_DIFFERENTIAL) != 0 };
+    report_file_summary(filename, summary);
+
+    return 0;
+}
+
+static int process_testcase_corpus(const char * filename, const struct sim65_corpus_type * corpus, enum sim65_cpu_mode_type cpu_mode, unsigned test_flags, unsigned number_of_threads,
+                                   struct sim65_file_summary_type * summary)
+{
+    unsigned testcase_error = 0;
+
+    if (number_of_threads <= 1)
+    {
+        testcase_error = run_corpus_testcases(corpus, 0, corpus->header->testcase_count, filename, cpu_mode, test_flags, stdout);
+    }
+    else
+    {
+        // All test cases are available in memory, so they are executed as a single batch.
+
+        struct testcase_batch_type batch;
+
+        memset(&batch, 0, sizeof(batch));
+        batch.filename = filename;
+        batch.cpu_mode = cpu_mode;
+        batch.test_flags = test_flags;
+        batch.first_testcase_index = 1;
+        batch.testcase_count = corpus->header->testcase_count;
+        batch.corpus = corpus;
+        batch.number_of_threads = number_of_threads;
+
+        if (run_testcase_batch(&batch, &testcase_error) != 0)
+        {
+            return -1;
+        }
+    }
+
+    *summary = (struct sim65_file_summary_type) { .testcase_count = corpus->header->testcase_count, .failure_count = testcase_error,
+                                                  .differential = (test_flags & F_TEST_DIFFERENTIAL) != 0 };
+    report_file_summary(filename, summary);
+
+    return 0;
+}
+
+// In sampling mode (--sample=N), only N test cases of each file are executed. The test cases of a file are divided
+// into N consecutive ranges of (nearly) equal size, and one test case is picked from each range. The pick depends
+// only on the seed, the name of the file, and the range, so a run can be repeated exactly.
+//
+// JSON test case files are read twice: once to count the test cases, which only requires finding the boundaries
+// of the array elements, and once to parse and execute the test cases that were picked.
+
+struct testcase_sample_type
+{
+    unsigned size;
+    uint64_t seed;
+};
+
+// Pick the test cases to execute, in increasing order. Returns the number of test cases picked.
+static uint32_t select_testcase_sample(const char * filename, uint32_t testcase_count, const struct testcase_sample_type * sample, uint32_t * selected)
+{
+    if (sample->size >= testcase_count)
+    {
+        for (uint32_t i = 0; i < testcase_count; ++i)
+        {
+            selected[i] = i;
+        }
+        return testcase_count;
+    }
+
+    // The extension is ignored, so a JSON test case file and its binary conversion yield the same sample.
+
+    const char * basename = strrchr(filename, '/');
+    basename = (basename != NULL) ? basename + 1 : filename;
+
+    uint64_t file_seed = sim65_hash_bytes(sim65_hash_bytes(SIM65_HASH_INITIAL, &sample->seed, sizeof(sample->seed)), basename, strcspn(basename, "."));
+
+    for (uint32_t i = 0; i < sample->size; ++i)
+    {
+        uint32_t begin = (uint64_t)testcase_count * i / sample->size;
+        uint32_t end = (uint64_t)testcase_count * (i + 1) / sample->size;
+        uint64_t random = sim65_hash_bytes(file_seed, &i, sizeof(i));
+        selected[i] = begin + random % (end - begin);
+    }
+
+    return sample->size;
+}
+
+// Upper bound of the 95% Wilson score interval for a failure rate, given the number of failures in a sample.
+static double failure_rate_upper_bound(unsigned failures, unsigned sample_size)
+{
+    if (sample_size == 0)
+    {
+        return 1.0;
+    }
+
+    const double z = 1.959964; // 97.5th percentile of the standard normal distribution.
+
+    double n = sample_size;
+    double p = failures / n;
+    double center = p + z * z / (2 * n);
+    double margin = z * sqrt(p * (1 - p) / n + z * z / (4 * n * n));
+
+    double bound = (center + margin) / (1 + z * z / n);
+    return (bound < 1.0) ? bound : 1.0;
+}
+
+static int count_json_testcases(const char * filename, uint32_t * testcase_count)
+{
+    struct json_array_stream_type * stream = malloc(sizeof(struct json_array_stream_type));
+    if (stream == NULL || json_array_stream_open(stream, filename) != 0)
+    {
+        free(stream);
+        return -1; // malloc() error, cannot open file, or not an array.
     }
 
-    if (field->valueint < 0 || field->valueint > 0xffff)
+    int next_result;
+    while ((next_result = json_array_stream_next(stream)) > 0)
     {
-        return -1; // Expecting an unsigned 16-bit value.
     }
 
-    *value = field->valueint;
+    *testcase_count = stream->element_count;
 
-    return 0; // Success.
+    json_array_stream_close(stream);
+    free(stream);
+
+    return next_result;
 }
 
-static int parse_json_machine_state_field(cJSON * json_testcase, char * field_name, struct machine_state_type * state)
+static int process_testcase_sample(const char * filename, enum sim65_cpu_mode_type cpu_mode, unsigned test_flags, const struct testcase_sample_type * sample,
+                                   struct sim65_file_summary_type * summary)
 {
-    if (!cJSON_IsObject(json_testcase))
+    struct sim65_corpus_type corpus;
+
+    int map_result = sim65_corpus_map(filename, &corpus);
+    if (map_result < 0)
     {
-        return -1;
+        return -1; // Cannot map file.
     }
 
-    cJSON * json_field = cJSON_GetObjectItemCaseSensitive(json_testcase, field_name);
+    // A file that is not a regular file can only be read once, so its test cases cannot be counted first.
 
-    if (parse_json_u16_field(json_field, "pc", &state->pc) != 0 ||
-        parse_json_u8_field (json_field, "s" , &state->s ) != 0 ||
-        parse_json_u8_field (json_field, "a" , &state->a ) != 0 ||
-        parse_json_u8_field (json_field, "x" , &state->x ) != 0 ||
-        parse_json_u8_field (json_field, "y" , &state->y ) != 0 ||
-        parse_json_u8_field (json_field, "p" , &state->p ) != 0)
+    struct stat st;
+    uint32_t testcase_count;
+
+    if (map_result == 0)
     {
-        return -1;
+        testcase_count = corpus.header->testcase_count;
+    }
+    else if (stat(filename, &st) != 0 || !S_ISREG(st.st_mode) || count_json_testcases(filename, &testcase_count) != 0)
+    {
+        return -1; // Cannot count test cases.
     }
 
-    cJSON * ramspec = cJSON_GetObjectItemCaseSensitive(json_field, "ram");
-    if (!cJSON_IsArray(ramspec))
+    uint32_t * selected = malloc(((sample->size < testcase_count) ? sample->size : testcase_count) * sizeof(uint32_t) + 1);
+    if (selected == NULL)
     {
-        return -1;
+        if (map_result == 0)
+        {
+            sim65_corpus_unmap(&corpus);
+        }
+        return -1; // malloc() error.
     }
 
-    // Initialize RAM to zero.
-    memset(state->ram, 0, 0x10000);
+    uint32_t selected_count = select_testcase_sample(filename, testcase_count, sample, selected);
 
-    // Perform the assignments specified in the JSON file.
-    for (cJSON * assignment = ramspec->child; assignment != NULL; assignment = assignment->next)
+    unsigned testcase_error = 0;
+    int result = 0;
+
+    if (map_result == 0)
     {
-        if (!cJSON_IsArray(assignment))
+        struct sim65_testcase_specification_type testcases[EXECUTE_BATCH_SIZE];
+        unsigned testcase_indices[EXECUTE_BATCH_SIZE];
+
+        for (uint32_t i = 0; i < selected_count; i += EXECUTE_BATCH_SIZE)
         {
-            return -1;
+            unsigned batch_size = (selected_count - i < EXECUTE_BATCH_SIZE) ? selected_count - i : EXECUTE_BATCH_SIZE;
+
+            for (unsigned j = 0; j < batch_size; ++j)
+            {
+                get_corpus_testcase(&corpus, selected[i + j], &testcases[j]);
+                testcase_indices[j] = selected[i + j] + 1;
+            }
+
+            testcase_error += run_testcases(testcases, testcase_indices, batch_size, filename, cpu_mode, test_flags, stdout);
         }
 
-        if (cJSON_GetArraySize(assignment) != 2)
+        sim65_corpus_unmap(&corpus);
+    }
+    else
+    {
+        // Only the test cases that were picked are parsed.
+
+        struct json_array_stream_type * stream = malloc(sizeof(struct json_array_stream_type));
+        if (stream == NULL || json_array_stream_open(stream, filename) != 0)
         {
-            return -1;
+            free(stream);
+            free(selected);
+            return -1; // malloc() error, cannot open file, or not an array.
         }
 
-        int address = assignment->child->valueint;
-        if (address < 0 || address > 0xffff)
+        struct testcase_buffer_type testcase_buffer = { NULL, 0, 0, NULL, 0 };
+
+        uint32_t next_selected = 0;
+        int next_result;
+
+        while (next_selected < selected_count && (next_result = json_array_stream_next(stream)) > 0)
         {
-            return -1;
+            uint32_t testcase_index = stream->element_count - 1;
+
+            if (testcase_index == selected[next_selected])
+            {
+                ++next_selected;
+
+                if (run_json_testcase(stream->element, stream->element_size, filename, testcase_index + 1, cpu_mode, test_flags, &testcase_buffer, stdout, &testcase_error) != 0)
+                {
+                    break; // JSON parse error.
+                }
+            }
         }
 
-        int value = assignment->child->next->valueint;
-        if (value < 0 || value > 0xff)
+        if (next_selected != selected_count)
         {
-            return -1;
+            result = -1; // Malformed test case file.
         }
 
-        state->ram[address] = value;
+        free(testcase_buffer.assignments);
+        free(testcase_buffer.bus);
+
+        json_array_stream_close(stream);
+        free(stream);
     }
+
+    free(selected);
+
+    if (result != 0)
+    {
+        return -1;
+    }
+
+    *summary = (struct sim65_file_summary_type) { .testcase_count = selected_count, .failure_count = testcase_error,
+                                                  .differential = (test_flags & F_TEST_DIFFERENTIAL) != 0,
+                                                  .population = testcase_count, .seed = sample->seed,
+                                                  .failure_rate_bound = failure_rate_upper_bound(testcase_error, selected_count) };
+    report_file_summary(filename, summary);
+
     return 0;
 }
 
-static int parse_json_testcase(cJSON * json_testcase, struct sim65_testcase_specification_type * testcase)
+static int process_testcase_file(char * filename, enum sim65_cpu_mode_type cpu_mode, unsigned test_flags, unsigned number_of_threads,
+                                 const struct testcase_sample_type * sample, struct sim65_file_summary_type * summary)
 {
-    if (!cJSON_IsObject(json_testcase))
+    if (sample != NULL)
     {
-        return -1; // We expect an object.
+        return process_testcase_sample(filename, cpu_mode, test_flags, sample, summary);
     }
 
-    cJSON * json_name = cJSON_GetObjectItemCaseSensitive(json_testcase, "name");
-    if (!cJSON_IsString(json_name))
+    // Binary test case files are mapped into memory; anything else is read as a JSON test case file.
+
+    struct sim65_corpus_type corpus;
+
+    int map_result = sim65_corpus_map(filename, &corpus);
+    if (map_result < 0)
     {
-        return -1;
+        return -1; // Cannot map file.
     }
-    testcase->name = json_name->valuestring;
-
-    parse_json_machine_state_field(json_testcase, "initial", &testcase->initial_state);
-    parse_json_machine_state_field(json_testcase, "final", &testcase->final_state);
 
-    cJSON * json_cycles = cJSON_GetObjectItemCaseSensitive(json_testcase, "cycles");
-    if (!cJSON_IsArray(json_cycles))
+    if (map_result == 0)
     {
-        return -1; // Should be an array.
+        int result = process_testcase_corpus(filename, &corpus, cpu_mode, test_flags, number_of_threads, summary);
+        sim65_corpus_unmap(&corpus);
+        return result;
     }
-    testcase->cycles = cJSON_GetArraySize(json_cycles);
 
-    return 0;
+    return process_testcase_stream(filename, cpu_mode, test_flags, number_of_threads, summary);
 }
 
-static int process_json_testcase_array(const char * filename, cJSON * json_testcase_array, enum sim65_cpu_mode_type cpu_mode, unsigned test_flags)
+static int convert_testcase_file(char * filename)
 {
-    if (!cJSON_IsArray(json_testcase_array))
+    // The binary file gets the name of the JSON file, with its ".json" extension (possibly followed by the
+    // extension of a compressed file) replaced by ".bin".
+
+    static const char * const json_extensions[] = { ".json", ".json.gz", ".json.zst" };
+
+    size_t filename_length = strlen(filename);
+    for (size_t i = 0; i < sizeof(json_extensions) / sizeof(json_extensions[0]); ++i)
     {
-        return -1; // We expect an array.
+        size_t extension_length = strlen(json_extensions[i]);
+        if (filename_length >= extension_length && strcmp(filename + filename_length - extension_length, json_extensions[i]) == 0)
+        {
+            filename_length -= extension_length;
+            break;
+        }
     }
 
-    unsigned testcase_index = 0; // First testcase will be 1, and so on.
-    unsigned testcase_error = 0;
+    char * binary_filename = malloc(filename_length + 5);
+    if (binary_filename == NULL)
+    {
+        return -1; // malloc() error.
+    }
+    memcpy(binary_filename, filename, filename_length);
+    strcpy(binary_filename + filename_length, ".bin");
+
+    struct json_array_stream_type * stream = malloc(sizeof(struct json_array_stream_type));
+    if (stream == NULL || json_array_stream_open(stream, filename) != 0)
+    {
+        free(stream);
+        free(binary_filename);
+        return -1; // malloc() error, cannot open file, or not an array.
+    }
 
-    for (cJSON * json_testcase = json_testcase_array->child; json_testcase != NULL; json_testcase = json_testcase->next)
+    struct sim65_corpus_writer_type writer;
+    sim65_corpus_writer_init(&writer);
+
+    int next_result;
+    while ((next_result = json_array_stream_next(stream)) > 0)
     {
-        ++testcase_index;
+        cJSON * json_testcase = cJSON_ParseWithLength(stream->element, stream->element_size);
+
+        int result = convert_json_testcase(json_testcase, &writer);
 
-        struct sim65_testcase_specification_type testcase;
+        json_arena_reset(); // Discards json_testcase.
 
-        int result = parse_json_testcase(json_testcase, &testcase);
         if (result != 0)
         {
-            printf("[%s:%u] ERROR: Testcase cannot be parsed.\n", filename, testcase_index);
-        }
-        else
-        {
-            int testcase_result = execute_testcase(&testcase, filename, testcase_index, cpu_mode, test_flags);
-            if (testcase_result != 0)
-            {
-                ++testcase_error;
-            }
+            next_result = -1; // Testcase cannot be converted.
+            break;
         }
     }
 
-    printf("[%s] INFO - Test file summary: %u of %u testcases show deviations from expected behavior.\n",
-           filename, testcase_error, testcase_index);
+    json_array_stream_close(stream);
+    free(stream);
 
-    return 0;
+    int result = -1;
+
+    if (next_result == 0 && sim65_corpus_writer_write(&writer, binary_filename) == 0)
+    {
+        printf("[%s] INFO - Converted %zu testcases to binary file: %s\n", filename, writer.testcase_count, binary_filename);
+        result = 0;
+    }
+
+    sim65_corpus_writer_free(&writer);
+    free(binary_filename);
+
+    return result;
 }
 
-static int process_testcase_file(char * filename, enum sim65_cpu_mode_type cpu_mode, unsigned test_flags)
+// Each FILE argument is a job: it is either tested, or converted to a binary file.
+
+struct job_type
+{
+    char * filename;
+    enum sim65_cpu_mode_type cpu_mode;
+    unsigned test_flags;
+    unsigned number_of_threads;
+    bool convert;
+    const char * cache_directory;   // NULL if results are not cached.
+    uint64_t executable_fingerprint;  // Hash of the sim65-test executable; see simulator_fingerprint().
+    struct sim65_manifest_type * manifest;  // NULL unless only files of changed handlers are to be tested.
+    struct testcase_sample_type sample;  // Size 0 unless only a sample of the test cases is to be executed.
+};
+
+// The part of the cache key that identifies the code that processing a job exercises. With handler fingerprints
+// (see sim65-fingerprint.c), this is the fingerprint of the handler of the opcode that the file tests, or of all
+// handlers if the file isn't named after an opcode, combined with the fingerprints of the entry points of the core
+// and of the harness, and of the run loops and the reference core if the job uses them. Rebuilding sim65-test
+// after a change to the handler of one opcode then only invalidates the entries of the files of that opcode.
+// Without handler fingerprints (e.g., on platforms that don't use ELF object files), the hash of the executable
+// is used, so any rebuild invalidates all entries.
+static uint64_t simulator_fingerprint(const struct job_type * job)
 {
-    FILE * f = fopen(filename, "r");
-    if (f == NULL)
+    if (sim65_core_fingerprint == 0)
     {
-        return -1; // Cannot open file.
+        return job->executable_fingerprint;
+    }
+
+    uint64_t fingerprint = sim65_hash_bytes(SIM65_HASH_INITIAL, &sim65_core_fingerprint, sizeof(sim65_core_fingerprint));
+    fingerprint = sim65_hash_bytes(fingerprint, &sim65_harness_fingerprint, sizeof(sim65_harness_fingerprint));
+
+    int opcode = sim65_testcase_file_opcode(job->filename);
+    if (opcode >= 0)
+    {
+        fingerprint = sim65_hash_bytes(fingerprint, &sim65_handler_fingerprints[job->cpu_mode][opcode], sizeof(uint64_t));
+    }
+    else
+    {
+        fingerprint = sim65_hash_bytes(fingerprint, sim65_handler_fingerprints[job->cpu_mode], sizeof(sim65_handler_fingerprints[job->cpu_mode]));
     }
 
-    int fseek_begin_result = fseek(f, 0, SEEK_END);
-    if (fseek_begin_result != 0)
+    if (job->test_flags & (F_TEST_RUN_LOOP | F_TEST_BLOCK_CACHE))
     {
-        fclose(f);
-        return -1; // fseek() to end error.
+        fingerprint = sim65_hash_bytes(fingerprint, &sim65_engine_fingerprint, sizeof(sim65_engine_fingerprint));
     }
 
-    long ftell_result = ftell(f);
-    if (ftell_result < 0)
+    if (job->test_flags & F_TEST_DIFFERENTIAL)
     {
-        fclose(f);
-        return -1; // ftell() error.
+        fingerprint = sim65_hash_bytes(fingerprint, &sim65_reference_fingerprint, sizeof(sim65_reference_fingerprint));
     }
 
-    size_t string_size = ftell_result;
+    return fingerprint;
+}
+
+// Process a test case file, replaying its output from the cache if possible.
+// If the output is replayed, the summary is left untouched.
+static int run_cached_job(const struct job_type * job, struct sim65_file_summary_type * summary)
+{
+    // The cache key covers everything that determines the output. The name of the file is included because it
+    // appears in the output. Files that cannot be hashed (e.g., pipes) are never cached.
 
-    char *string = malloc(string_size);
-    if (string == NULL)
+    uint64_t file_hash;
+    if (sim65_hash_file(job->filename, &file_hash) != 0)
     {
-        fclose(f);
-        return -1; // malloc() error.
+        return process_testcase_file(job->filename, job->cpu_mode, job->test_flags, job->number_of_threads, (job->sample.size != 0) ? &job->sample : NULL, summary);
+    }
+
+    uint64_t key_values[7] = { file_hash, job->cpu_mode, job->test_flags, simulator_fingerprint(job),
+                               job->sample.size, (job->sample.size != 0) ? job->sample.seed : 0, output_format };
+
+    uint64_t key = sim65_hash_bytes(SIM65_HASH_INITIAL, key_values, sizeof(key_values));
+    key = sim65_hash_bytes(key, job->filename, strlen(job->filename));
+
+    FILE * cached_output = sim65_cache_lookup(job->cache_directory, key);
+    if (cached_output != NULL)
+    {
+        int result = sim65_copy_output(cached_output);
+        fclose(cached_output);
+        return result;
+    }
+
+    // Not in the cache: capture the output in a temporary file while processing the file.
+
+    FILE * output = tmpfile();
+    if (output == NULL)
+    {
+        return -1; // tmpfile() error.
     }
 
-    int fseek_end_result = fseek(f, 0, SEEK_SET);
-    if (fseek_end_result != 0)
+    fflush(stdout);
+
+    int saved_stdout = dup(STDOUT_FILENO);
+    if (saved_stdout < 0 || dup2(fileno(output), STDOUT_FILENO) < 0)
     {
-        free(string);
-        fclose(f);
-        return -1; // fseek() to beginning error.
+        if (saved_stdout >= 0)
+        {
+            close(saved_stdout);
+        }
+        fclose(output);
+        return -1; // dup() or dup2() error.
     }
 
-    size_t number_of_items = fread(string, 1, string_size, f);
-    if (number_of_items != string_size)
+    int result = process_testcase_file(job->filename, job->cpu_mode, job->test_flags, job->number_of_threads, (job->sample.size != 0) ? &job->sample : NULL, summary);
+
+    fflush(stdout);
+
+    if (dup2(saved_stdout, STDOUT_FILENO) < 0)
     {
-        free(string);
-        fclose(f);
-        return -1; // fread() error.
+        result = -1;
     }
+    close(saved_stdout);
 
-    int fclose_result = fclose(f);
-    if (fclose_result != 0)
+    if (sim65_copy_output(output) != 0)
     {
-        free(string);
-        return -1; // close() error.
+        result = -1;
     }
 
-    cJSON *json_testcase_array = cJSON_ParseWithLength(string, string_size);
-    free(string);
+    // Only the output of a successful run is stored; failing to store it is not an error.
 
-    if (!cJSON_IsArray(json_testcase_array))
+    if (result == 0)
     {
-        return -1; // JSON parse error.
+        sim65_cache_store(job->cache_directory, key, output);
+    }
+
+    fclose(output);
+
+    return result;
+}
+
+static int run_job(void * context, unsigned job_index)
+{
+    const struct job_type * job = (const struct job_type *)context + job_index;
+
+    if (job->convert)
+    {
+        return convert_testcase_file(job->filename);
+    }
+
+    // With --changed-only, a file is skipped if it tests a single opcode, and neither its contents nor the code
+    // that it exercises (see simulator_fingerprint()) changed since the file last passed.
+
+    const struct sim65_manifest_entry_type * entry = NULL;
+    uint64_t fingerprint = 0;
+
+    if (job->manifest != NULL && (job->test_flags & ~SIM65_MANIFEST_TEST_FLAGS) == 0)
+    {
+        int opcode = sim65_testcase_file_opcode(job->filename);
+        uint64_t file_hash;
+        if (opcode >= 0 && sim65_hash_file(job->filename, &file_hash) == 0)
+        {
+            uint64_t key_values[2] = { file_hash, simulator_fingerprint(job) };
+            fingerprint = sim65_hash_bytes(SIM65_HASH_INITIAL, key_values, sizeof(key_values));
+            entry = &job->manifest->entries[job->cpu_mode][opcode][job->test_flags];
+        }
+    }
+
+    if (fingerprint != 0 && entry->fingerprint == fingerprint)
+    {
+        struct sim65_file_summary_type file_summary = { .testcase_count = entry->testcase_count, .skipped = true };
+        report_file_summary(job->filename, &file_summary);
+        return 0;
+    }
+
+    struct sim65_file_summary_type summary = { .failure_count = UINT_MAX };
+
+    int result;
+    if (job->cache_directory != NULL)
+    {
+        result = run_cached_job(job, &summary);
+    }
+    else
+    {
+        result = process_testcase_file(job->filename, job->cpu_mode, job->test_flags, job->number_of_threads, (job->sample.size != 0) ? &job->sample : NULL, &summary);
     }
 
-    int result = process_json_testcase_array(filename, json_testcase_array, cpu_mode, test_flags);
+    // A sample that passes doesn't show that the whole file passes.
 
-    cJSON_Delete(json_testcase_array);
+    if (result == 0 && fingerprint != 0 && summary.failure_count == 0 && job->sample.size == 0)
+    {
+        sim65_manifest_record(job->manifest, job->cpu_mode, sim65_testcase_file_opcode(job->filename), job->test_flags, fingerprint, summary.testcase_count);
+    }
 
     return result;
 }
 
+static void report_job_failure(void * context, unsigned job_index)
+{
+    const struct job_type * job = (const struct job_type *)context + job_index;
+
+    // The job may have run in another process, so the reason it failed is not known here; a binary file
+    // of an older version is the one failure that the user can't tell apart from a corrupt file.
+
+    bool outdated = !job->convert && sim65_corpus_is_outdated(job->filename);
+
+    if (output_format == SIM65_OUTPUT_JSONL)
+    {
+        write_file_error_record(job->filename, outdated ? "reconvert" : job->convert ? "convert" : "process", stdout);
+    }
+    else if (outdated)
+    {
+        printf("Unable to process file: %s (converted by an older version of sim65-test; convert its JSON file again with --convert)\n", job->filename);
+    }
+    else
+    {
+        printf("Unable to %s file: %s\n", job->convert ? "convert" : "process", job->filename);
+    }
+}
+
 void print_help(void)
 {
-    puts("Usage: sim65-test [--cpu-mode=<mode>] [FILE]...");
+    puts("Usage: sim65-test [--jobs=N] [--threads=N] [--cache-dir=DIR] [--changed-only [--manifest=FILE]]");
+    puts("                  [--sample=N [--seed=S]] [--output-format=<format>] [--cpu-mode=<mode>] [FILE]...");
+    puts("   or: sim65-test [--jobs=N] --convert [FILE]...");
     puts("");
     puts("Test the instruction execution code from sim65 using JSON-formatted test cases.");
     puts("");
@@ -260,12 +2016,75 @@ void print_help(void)
     puts("  --cpu-mode=6502      Simulate a vanilla 6502 processor.");
     puts("  --cpu-mode=6502X     Simulate a 6502X processor.");
     puts("  --cpu-mode=65C02     Simulate a 65C02 processor.");
+    puts("");
+    puts("With --enable-bus-test, the memory accesses made by sim65 are also compared, cycle by cycle,");
+    puts("to the bus activity specified in the 'cycles' array of each test case. The first access that");
+    puts("differs is reported. sim65 doesn't perform the dummy accesses of a real 6502, so expect");
+    puts("many differences.");
+    puts("");
+    puts("With --differential, each test case is executed on both sim65 and a reference core that is");
+    puts("linked into sim65-test, and their registers, memory, and cycle counts are compared with each");
+    puts("other instead of with the test case. Only the test cases on which they disagree are reported.");
+    puts("The reference core is built from the sources in REFERENCE_DIR ('make REFERENCE_DIR=...').");
+    puts("");
+    puts("By default, sim65 executes each test case with ExecuteInsn(), as a single-stepping debugger");
+    puts("would. With --engine=run, it uses the RunInsns() loop that executes programs instead, and");
+    puts("with --engine=block, the RunBlocks() loop that executes them from a cache of pre-decoded");
+    puts("blocks. --engine=insn selects ExecuteInsn() again.");
+    puts("");
+    puts("Parsing the JSON test case files takes most of the time of a test run. With the --convert");
+    puts("option, each FILE is instead converted to a compact binary file with the same name, but");
+    puts("with the '.json' extension replaced by '.bin'. Binary files can be given as FILE arguments");
+    puts("just like JSON files; they are mapped into memory and used without any parsing.");
+    puts("");
+    puts("JSON files compressed with gzip are decompressed while they are read, as are files compressed");
+    puts("with zstd if sim65-test was built with 'make WITH_ZSTD=1'. The compression is recognized from");
+    puts("the contents of the file; '.json.gz' and '.json.zst' extensions are replaced by '.bin' on --convert.");
+    puts("");
+    puts("Files are processed one at a time by default. With --jobs=N, up to N files are processed");
+    puts("in parallel by separate processes; --jobs=0 uses one process per available CPU core.");
+    puts("The output is the same as that of a serial run.");
+    puts("");
+    puts("With --cache-dir=DIR, the output for each file is stored in directory DIR. When the same");
+    puts("file is tested again with the same options, the stored output is replayed instead of running");
+    puts("the test cases. The cache is keyed on a hash of the file contents and on fingerprints of the");
+    puts("machine code of the sim65 handler of the opcode that the file tests and of the test harness,");
+    puts("so changing a file, a handler, or the harness invalidates the entries it affects.");
+    puts("");
+    puts("With --changed-only, a file named after the opcode it tests (as in the 65x02 test suite,");
+    puts("e.g. 'a9.json') is only tested if the file, or the machine code of the sim65 handler for");
+    puts("that opcode or of the harness, changed since the file last passed. Passing results are");
+    puts("recorded in a manifest file, '" SIM65_DEFAULT_MANIFEST_FILENAME "' by default; use");
+    puts("--manifest=FILE to select another one.");
+    puts("");
+    puts("With --sample=N, only N test cases of each file are executed, picked evenly across the");
+    puts("file; --sample=0 executes all test cases again. The pick is determined by --seed=S (default 0).");
+    puts("For each file, an upper bound on its failure rate at 95% confidence is reported.");
+    puts("");
+    puts("The results are written as a human-readable log by default. With --output-format=jsonl,");
+    puts("one JSON object per line is written instead: one for each test case, with the failed checks");
+    puts("and their expected and actual values, and one summarizing each file. See sim65-results.h.");
+    puts("");
+    puts("With --threads=N, the test cases within each file are executed by N threads, each with");
+    puts("its own simulated CPU and memory; --threads=0 uses one thread per available CPU core.");
+    puts("This speeds up the processing of a single large file; the output does not change.");
     puts("");}
 
 int main(int argc, char ** argv)
 {
     enum sim65_cpu_mode_type cpu_mode = SIM65_CPU_6502;
     unsigned test_flags = (F_TEST_CYCLECOUNT | F_TEST_MEMORY); // Enable all tests.
+    bool convert = false;
+    unsigned max_processes = 1;
+    unsigned number_of_threads = 1;
+    const char * cache_directory = NULL;
+    uint64_t executable_fingerprint = 0;
+    bool changed_only = false;
+    struct testcase_sample_type sample = { 0, 0 };
+    const char * manifest_filename = SIM65_DEFAULT_MANIFEST_FILENAME;
+
+    cJSON_Hooks json_hooks = { json_arena_allocate, json_arena_deallocate };
+    cJSON_InitHooks(&json_hooks);
 
     if (argc == 1)
     {
@@ -284,7 +2103,144 @@ int main(int argc, char ** argv)
 
     for (int i = 1; i < argc; ++i)
     {
-        if (strcmp(argv[i], "--cpu-mode=6502") == 0)
+        if (strcmp(argv[i], "--convert") == 0)
+        {
+            convert = true;
+        }
+        else if (strcmp(argv[i], "--changed-only") == 0)
+        {
+            changed_only = true;
+        }
+        else if (strncmp(argv[i], "--manifest=", 11) == 0)
+        {
+            manifest_filename = argv[i] + 11;
+        }
+        else if (strcmp(argv[i], "--output-format=text") == 0)
+        {
+            output_format = SIM65_OUTPUT_TEXT;
+        }
+        else if (strcmp(argv[i], "--output-format=jsonl") == 0)
+        {
+            output_format = SIM65_OUTPUT_JSONL;
+        }
+        else if (strncmp(argv[i], "--output-format=", 16) == 0)
+        {
+            printf("Bad output format: %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // A full run produces a lot of output. Unless it goes to a terminal, it is written in large blocks.
+
+    if (!isatty(STDOUT_FILENO))
+    {
+        setvbuf(stdout, NULL, _IOFBF, 1 << 20);
+    }
+
+    // The manifest is loaded before any jobs are started, so processes running in parallel inherit it.
+
+    static struct sim65_manifest_type manifest;
+
+    if (changed_only && sim65_manifest_load(&manifest, manifest_filename) != 0)
+    {
+        printf("Unable to read manifest file: %s\n", manifest_filename);
+        return EXIT_FAILURE;
+    }
+
+    if (changed_only && sim65_core_fingerprint == 0 &&
+        sim65_hash_file("/proc/self/exe", &executable_fingerprint) != 0 && sim65_hash_file(argv[0], &executable_fingerprint) != 0)
+    {
+        printf("Unable to determine the fingerprint of the simulator for the manifest.\n");
+        return EXIT_FAILURE;
+    }
+
+    struct job_type * jobs = malloc(argc * sizeof(struct job_type));
+    if (jobs == NULL)
+    {
+        return EXIT_FAILURE;
+    }
+
+    unsigned number_of_jobs = 0;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--convert") == 0 || strcmp(argv[i], "--changed-only") == 0 || strncmp(argv[i], "--manifest=", 11) == 0 ||
+            strncmp(argv[i], "--output-format=", 16) == 0)
+        {
+            // Handled above.
+        }
+        else if (strncmp(argv[i], "--jobs=", 7) == 0)
+        {
+            char * endptr;
+            long value = strtol(argv[i] + 7, &endptr, 10);
+            if (argv[i][7] == '\0' || *endptr != '\0' || value < 0 || value > 1024)
+            {
+                printf("Bad number of jobs: %s\n", argv[i]);
+                free(jobs);
+                return EXIT_FAILURE;
+            }
+            if (value == 0)
+            {
+                long number_of_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+                value = (number_of_cpus > 0) ? number_of_cpus : 1;
+            }
+            max_processes = value;
+        }
+        else if (strncmp(argv[i], "--threads=", 10) == 0)
+        {
+            char * endptr;
+            long value = strtol(argv[i] + 10, &endptr, 10);
+            if (argv[i][10] == '\0' || *endptr != '\0' || value < 0 || value > 1024)
+            {
+                printf("Bad number of threads: %s\n", argv[i]);
+                free(jobs);
+                return EXIT_FAILURE;
+            }
+            if (value == 0)
+            {
+                long number_of_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+                value = (number_of_cpus > 0) ? number_of_cpus : 1;
+            }
+            number_of_threads = value;
+        }
+        else if (strncmp(argv[i], "--sample=", 9) == 0 || strncmp(argv[i], "--seed=", 7) == 0)
+        {
+            bool is_seed = (argv[i][2] == 's' && argv[i][3] == 'e');
+            const char * value_string = argv[i] + (is_seed ? 7 : 9);
+            char * endptr;
+            errno = 0;
+            unsigned long long value = strtoull(value_string, &endptr, 10);
+            if (*value_string == '\0' || *endptr != '\0' || errno != 0 || *value_string == '-' || (!is_seed && value > UINT32_MAX))
+            {
+                printf("Bad %s: %s\n", is_seed ? "seed" : "sample size", argv[i]);
+                free(jobs);
+                return EXIT_FAILURE;
+            }
+            if (is_seed)
+            {
+                sample.seed = value;
+            }
+            else
+            {
+                sample.size = value;
+            }
+        }
+        else if (strncmp(argv[i], "--cache-dir=", 12) == 0)
+        {
+            cache_directory = argv[i] + 12;
+            if (*cache_directory == '\0')
+            {
+                cache_directory = NULL; // An empty directory name disables caching for the files that follow.
+            }
+            else if (sim65_core_fingerprint == 0 && executable_fingerprint == 0 &&
+                     sim65_hash_file("/proc/self/exe", &executable_fingerprint) != 0 && sim65_hash_file(argv[0], &executable_fingerprint) != 0)
+            {
+                printf("Unable to determine the fingerprint of the simulator for the result cache.\n");
+                free(jobs);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (strcmp(argv[i], "--cpu-mode=6502") == 0)
         {
             cpu_mode = SIM65_CPU_6502;
         }
@@ -304,16 +2260,46 @@ int main(int argc, char ** argv)
         {
             test_flags &= ~F_TEST_MEMORY;
         }
+        else if(strcmp(argv[i], "--enable-bus-test") == 0)
+        {
+            test_flags |= F_TEST_BUS;
+        }
+        else if(strcmp(argv[i], "--differential") == 0)
+        {
+            test_flags |= F_TEST_DIFFERENTIAL;
+        }
+        else if(strcmp(argv[i], "--engine=insn") == 0)
+        {
+            test_flags &= ~(F_TEST_RUN_LOOP | F_TEST_BLOCK_CACHE);
+        }
+        else if(strcmp(argv[i], "--engine=run") == 0)
+        {
+            test_flags &= ~F_TEST_BLOCK_CACHE;
+            test_flags |= F_TEST_RUN_LOOP;
+        }
+        else if(strcmp(argv[i], "--engine=block") == 0)
+        {
+            test_flags &= ~F_TEST_RUN_LOOP;
+            test_flags |= F_TEST_BLOCK_CACHE;
+        }
         else
         {
-            int result = process_testcase_file(argv[i], cpu_mode, test_flags);
-            if (result != 0)
-            {
-                printf("Unable to process file: %s\n", argv[i]);
-                return EXIT_FAILURE;
-            }
+            jobs[number_of_jobs].filename = argv[i];
+            jobs[number_of_jobs].cpu_mode = cpu_mode;
+            jobs[number_of_jobs].test_flags = test_flags;
+            jobs[number_of_jobs].number_of_threads = number_of_threads;
+            jobs[number_of_jobs].convert = convert;
+            jobs[number_of_jobs].cache_directory = cache_directory;
+            jobs[number_of_jobs].executable_fingerprint = executable_fingerprint;
+            jobs[number_of_jobs].manifest = changed_only ? &manifest : NULL;
+            jobs[number_of_jobs].sample = sample;
+            ++number_of_jobs;
         }
     }
 
-    return EXIT_SUCCESS;
+    int result = sim65_run_jobs(number_of_jobs, max_processes, run_job, report_job_failure, jobs);
+
+    free(jobs);
+
+    return (result == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -7,14 +7,16 @@
 #include <assert.h>
 #include <string.h>
 #include <stdbool.h>
+#include <setjmp.h>
 
 #include "6502.h"
 #include "memory.h"
 
 #include "sim65-testcase.h"
 
-static bool sim65_reported_error;
-static bool sim65_reported_warning;
+static SIM65_THREAD_LOCAL bool sim65_reported_error;
+static SIM65_THREAD_LOCAL bool sim65_reported_warning;
+static SIM65_THREAD_LOCAL jmp_buf * sim65_error_exit;  // Where Error() leaves the run loops; see run_instruction().
 
 /////////////////////////////////////////////////////////////////// start of re-implementation of functions that are called from 6502.c.
 
@@ -28,6 +30,11 @@ void Error(const char * Format, ...)
 {
     (void)Format;
     sim65_reported_error = true;
+
+    if (sim65_error_exit != NULL)
+    {
+        longjmp(*sim65_error_exit, 1);
+    }
 }
 
 void Warning(const char * Format, ...)
@@ -46,8 +53,84 @@ static uint8_t fix_p_register_value(uint8_t p)
     return p;
 }
 
-int execute_testcase(struct sim65_testcase_specification_type * testcase, const char * filename, unsigned testcase_index, enum sim65_cpu_mode_type cpu_mode, unsigned test_flags)
+static bool find_memory_value(const struct machine_state_type * state, uint16_t address, uint8_t * value)
+{
+    // If a location is listed more than once, the last assignment counts.
+    bool found = false;
+    for (unsigned i = 0; i < state->ram_size; ++i)
+    {
+        if (state->ram[i].address == address)
+        {
+            *value = state->ram[i].value;
+            found = true;
+        }
+    }
+    return found;
+}
+
+static uint8_t expected_memory_value(const struct sim65_testcase_specification_type * testcase, uint16_t address)
+{
+    // Locations not listed in the final state keep their initial value; locations listed in neither state are zero.
+    uint8_t value = 0;
+    if (!find_memory_value(&testcase->final_state, address, &value))
+    {
+        find_memory_value(&testcase->initial_state, address, &value);
+    }
+    return value;
+}
+
+static unsigned run_instruction(unsigned test_flags)
+{
+    // RunInsns() and RunBlocks() stop after the first instruction, as that takes at least one cycle. An illegal
+    // opcode doesn't advance the PC or set a cycle count, so they would execute it over and over; as in sim65,
+    // where Error() ends the process, Error() ends the run.
+
+    jmp_buf error_exit;
+
+    if (setjmp(error_exit) != 0)
+    {
+        sim65_error_exit = NULL;
+        return 0;
+    }
+
+    sim65_error_exit = &error_exit;
+    unsigned cycles = (test_flags & F_TEST_BLOCK_CACHE) ? RunBlocks(1) : RunInsns(1);
+    sim65_error_exit = NULL;
+
+    return cycles;
+}
+
+uint8_t execute_instruction(unsigned test_flags, unsigned * cycles)
+{
+    sim65_reported_error = false;
+    sim65_reported_warning = false;
+
+    *cycles = (test_flags & (F_TEST_RUN_LOOP | F_TEST_BLOCK_CACHE)) ? run_instruction(test_flags) : ExecuteInsn();
+
+    uint8_t notices = 0;
+
+    if (sim65_reported_error)
+    {
+        // The handler of illegal opcodes calls Error(), which doesn't return in sim65, without setting a cycle
+        // count; what ExecuteInsn() returns is that of the previous instruction executed by the same thread.
+        // It is reported as 0 and not checked, so that the output doesn't depend on --threads and --jobs.
+        notices |= SIM65_NOTICE_ILLEGAL_INSTRUCTION | SIM65_NOTICE_CYCLES_UNSPECIFIED;
+        *cycles = 0;
+    }
+
+    if (sim65_reported_warning)
+    {
+        notices |= SIM65_NOTICE_JMP_INDIRECT_BUG;
+    }
+
+    return notices;
+}
+
+int execute_testcase_batch(const struct sim65_testcase_specification_type * testcases, unsigned count, enum sim65_cpu_mode_type cpu_mode, unsigned test_flags,
+                           struct sim65_testcase_result_type * results)
 {
+    // Everything that doesn't depend on the individual test cases is done once per batch.
+
     switch (cpu_mode)
     {
         case SIM65_CPU_6502:
@@ -74,109 +157,354 @@ int execute_testcase(struct sim65_testcase_specification_type * testcase, const
         }
     }
 
+    // Record the memory locations written from here on, so that we can verify and restore just those.
+
+    MemJournalEnable(true);
+
     // Set the RESET vector, with a preceding JMP instruction.
 
     MemWriteByte(0xfffb, 0x4c);
     MemWriteWord(0xfffc, 0xfffb);
 
     // Reset the CPU. This will set the PC to the value found in (0xfffc, 0xfffd), which is 0xfffb.
-    // There, a "jmp $fffb" instruction will be found.
+    // There, a "jmp $fffb" instruction will be found. Apart from the registers, which each test case sets
+    // itself, a reset only clears pending interrupt requests; nothing in a test case raises those.
 
-    sim65_reported_error = false;
-    sim65_reported_warning = false;
+    Reset();
 
-    // Initialize the sim65 state.
+    // Memory is all-zero between test cases, except for the RESET vector we just used.
+    Mem[0xfffb] = 0;
+    Mem[0xfffc] = 0;
+    Mem[0xfffd] = 0;
 
-    Reset();
+    // The blocks cached by RunBlocks() are kept from batch to batch and from test case to test case. The page
+    // generations that invalidate them don't see writes made to Mem directly, so those are reported with
+    // MemPageWritten().
+    MemPageWritten(0xfffb);
+
+    // The bus trace costs time on every memory access, so it is only enabled if it will be verified.
 
-    Regs.AC = testcase->initial_state.a;
-    Regs.XR = testcase->initial_state.x;
-    Regs.YR = testcase->initial_state.y;
-    Regs.SR = fix_p_register_value(testcase->initial_state.p);
-    Regs.SP = testcase->initial_state.s;
-    Regs.PC = testcase->initial_state.pc;
+    MemTraceEnable((test_flags & F_TEST_BUS) != 0);
 
-    // Initialize memory according to the initial (pre-instruction) state specified in the testcase.
-    memcpy(Mem, testcase->initial_state.ram, 0x10000);
+    unsigned failed_testcases = 0;
 
-    // Run a single instruction.
-    unsigned sim65_cyclecount = ExecuteInsn();
+    for (unsigned testcase_index = 0; testcase_index < count; ++testcase_index)
+    {
+        const struct sim65_testcase_specification_type * testcase = &testcases[testcase_index];
+        struct sim65_testcase_result_type * result = &results[testcase_index];
+
+        // Initialize the sim65 state.
+
+        Regs.AC = testcase->initial_state.a;
+        Regs.XR = testcase->initial_state.x;
+        Regs.YR = testcase->initial_state.y;
+        Regs.SR = fix_p_register_value(testcase->initial_state.p);
+        Regs.SP = testcase->initial_state.s;
+        Regs.PC = testcase->initial_state.pc;
+
+        MemJournalClear();
+
+        // Initialize memory according to the initial (pre-instruction) state specified in the testcase.
+        for (unsigned i = 0; i < testcase->initial_state.ram_size; ++i)
+        {
+            Mem[testcase->initial_state.ram[i].address] = testcase->initial_state.ram[i].value;
+            MemPageWritten(testcase->initial_state.ram[i].address);
+        }
+
+        MemTraceClear();
 
-    // Verify state of CPU and memory and cycle count.
+        // Run a single instruction.
 
+        unsigned sim65_cyclecount;
+        uint8_t notices = execute_instruction(test_flags, &sim65_cyclecount);
+
+        // Verify state of CPU and memory and cycle count.
+
+        memset(result, 0, sizeof(*result));
+
+        result->pc = Regs.PC;
+        result->s = Regs.SP;
+        result->a = Regs.AC;
+        result->x = Regs.XR;
+        result->y = Regs.YR;
+        result->p = Regs.SR;
+        result->cycles = sim65_cyclecount;
+        result->notices = notices;
+
+        if (Regs.AC != testcase->final_state.a)
+        {
+            result->errors |= SIM65_ERROR_A;
+        }
+
+        if (Regs.XR != testcase->final_state.x)
+        {
+            result->errors |= SIM65_ERROR_X;
+        }
+
+        if (Regs.YR != testcase->final_state.y)
+        {
+            result->errors |= SIM65_ERROR_Y;
+        }
+
+        if (Regs.SR != fix_p_register_value(testcase->final_state.p))
+        {
+            result->errors |= SIM65_ERROR_P;
+        }
+
+        if (Regs.SP != testcase->final_state.s)
+        {
+            result->errors |= SIM65_ERROR_S;
+        }
+
+        if (Regs.PC != testcase->final_state.pc)
+        {
+            result->errors |= SIM65_ERROR_PC;
+        }
+
+        if ((test_flags & F_TEST_CYCLECOUNT) && !(result->notices & SIM65_NOTICE_CYCLES_UNSPECIFIED) && sim65_cyclecount != testcase->cycles)
+        {
+            result->errors |= SIM65_ERROR_CYCLES;
+        }
+
+        if (test_flags & F_TEST_MEMORY)
+        {
+            // Verify the locations listed in the initial and final states, and the locations written by the
+            // instruction. Any other location is still zero, which is what the testcase expects there.
+            // We report the lowest address with a difference.
+
+            const uint16_t * journal = MemJournalGetEntries();
+            unsigned journal_size = MemJournalGetSize();
+
+            bool memory_difference = false;
+            uint16_t address = 0;
+
+            const struct machine_state_type * states[2] = { &testcase->initial_state, &testcase->final_state };
+
+            for (unsigned j = 0; j < 2; ++j)
+            {
+                for (unsigned i = 0; i < states[j]->ram_size; ++i)
+                {
+                    uint16_t listed_address = states[j]->ram[i].address;
+                    if (Mem[listed_address] != expected_memory_value(testcase, listed_address) && (!memory_difference || listed_address < address))
+                    {
+                        memory_difference = true;
+                        address = listed_address;
+                    }
+                }
+            }
+
+            if (MemJournalOverflowed())
+            {
+                // The journal is incomplete; verify all of memory.
+                for (unsigned written_address = 0; written_address < 0x10000 && !(memory_difference && written_address >= address); ++written_address)
+                {
+                    if (Mem[written_address] != expected_memory_value(testcase, written_address))
+                    {
+                        memory_difference = true;
+                        address = written_address;
+                    }
+                }
+            }
+            else
+            {
+                for (unsigned i = 0; i < journal_size; ++i)
+                {
+                    uint16_t written_address = journal[i];
+                    if (Mem[written_address] != expected_memory_value(testcase, written_address) && (!memory_difference || written_address < address))
+                    {
+                        memory_difference = true;
+                        address = written_address;
+                    }
+                }
+            }
+
+            if (memory_difference)
+            {
+                result->errors |= SIM65_ERROR_MEMORY;
+                result->memory_address = address;
+                result->memory_value = Mem[address];
+                result->memory_expected = expected_memory_value(testcase, address);
+            }
+        }
+
+        if (test_flags & F_TEST_BUS)
+        {
+            // Find the first cycle in which sim65 made a different access than the test case expects, or made an
+            // access where none is expected, or vice versa. Accesses beyond the capacity of the trace are unknown.
+
+            const MemAccess * trace = MemTraceGetEntries();
+            unsigned trace_size = MemTraceGetSize();
+            unsigned cycle = 0;
+
+            while (cycle < trace_size && cycle < testcase->cycles &&
+                   trace[cycle].Addr == testcase->bus[cycle].address &&
+                   trace[cycle].Val == testcase->bus[cycle].value &&
+                   trace[cycle].Write == (testcase->bus[cycle].type == SIM65_BUS_WRITE))
+            {
+                ++cycle;
+            }
+
+            if (cycle < trace_size || cycle < testcase->cycles || MemTraceOverflowed())
+            {
+                result->errors |= SIM65_ERROR_BUS;
+                result->bus_cycle = cycle;
+
+                if (cycle < trace_size)
+                {
+                    result->bus_access.address = trace[cycle].Addr;
+                    result->bus_access.value = trace[cycle].Val;
+                    result->bus_access.type = trace[cycle].Write ? SIM65_BUS_WRITE : SIM65_BUS_READ;
+                }
+                else
+                {
+                    result->bus_access.type = SIM65_BUS_NONE;
+                }
+            }
+        }
+
+        // Return memory to its all-zero state for the next testcase. Only the locations set up by us and the locations
+        // written by the instruction can be non-zero.
+
+        if (MemJournalOverflowed())
+        {
+            memset(Mem, 0, 0x10000);
+            FlushBlocks();
+        }
+        else
+        {
+            const uint16_t * journal = MemJournalGetEntries();
+            unsigned journal_size = MemJournalGetSize();
+            for (unsigned i = 0; i < journal_size; ++i)
+            {
+                Mem[journal[i]] = 0;
+                MemPageWritten(journal[i]);
+            }
+        }
+
+        for (unsigned i = 0; i < testcase->initial_state.ram_size; ++i)
+        {
+            Mem[testcase->initial_state.ram[i].address] = 0;
+            MemPageWritten(testcase->initial_state.ram[i].address);
+        }
+
+        if (result->errors != 0)
+        {
+            ++failed_testcases;
+        }
+    }
+
+    return failed_testcases;
+}
+
+static void format_bus_access(char * text, size_t size, const struct bus_access_type * access)
+{
+    if (access == NULL || access->type == SIM65_BUS_NONE)
+    {
+        snprintf(text, size, "no access");
+    }
+    else
+    {
+        snprintf(text, size, "%s 0x%02x at 0x%04x", (access->type == SIM65_BUS_WRITE) ? "write" : "read", access->value, access->address);
+    }
+}
+
+int report_testcase_result(const struct sim65_testcase_specification_type * testcase, const struct sim65_testcase_result_type * result,
+                           const char * filename, unsigned testcase_index, FILE * out)
+{
     unsigned errors_seen = 0;
     unsigned notices_seen = 0;
 
-    if (sim65_reported_error)
+    if (result->notices & SIM65_NOTICE_ILLEGAL_INSTRUCTION)
     {
-        printf("[%s:%u (\"%s\")] NOTICE - sim65 reported an illegal instruction at address 0x%04x and tried to halt execution.\n", filename, testcase_index, testcase->name, Regs.PC);
+        fprintf(out, "[%s:%u (\"%s\")] NOTICE - sim65 reported an illegal instruction at address 0x%04x and tried to halt execution.\n", filename, testcase_index, testcase->name, result->pc);
         ++notices_seen;
     }
 
 
-    if (sim65_reported_warning)
+    if (result->notices & SIM65_NOTICE_JMP_INDIRECT_BUG)
     {
-        printf("[%s:%u (\"%s\")] NOTICE - sim65 reported it encountered the JMP-indirect 6502 bug at address 0x%04x.\n", filename, testcase_index, testcase->name, Regs.PC);
+        fprintf(out, "[%s:%u (\"%s\")] NOTICE - sim65 reported it encountered the JMP-indirect 6502 bug at address 0x%04x.\n", filename, testcase_index, testcase->name, result->pc);
         ++notices_seen;
     }
 
-    if (Regs.AC != testcase->final_state.a)
+    if (result->notices & SIM65_NOTICE_CYCLES_UNSPECIFIED)
     {
-        printf("[%s:%u (\"%s\")] ERROR - A register check failed (expected: 0x%02x, sim65: 0x%02x).\n", filename, testcase_index, testcase->name, testcase->final_state.a, Regs.AC);
+        fprintf(out, "[%s:%u (\"%s\")] NOTICE - the cycle count of the instruction is unspecified and was not checked.\n", filename, testcase_index, testcase->name);
+        ++notices_seen;
+    }
+
+    if (result->errors & SIM65_ERROR_A)
+    {
+        fprintf(out, "[%s:%u (\"%s\")] ERROR - A register check failed (expected: 0x%02x, sim65: 0x%02x).\n", filename, testcase_index, testcase->name, testcase->final_state.a, result->a);
         ++errors_seen;
     }
 
-    if (Regs.XR != testcase->final_state.x)
+    if (result->errors & SIM65_ERROR_X)
     {
-        printf("[%s:%u (\"%s\")] ERROR - X register check failed (expected: 0x%02x, sim65: 0x%02x).\n", filename, testcase_index, testcase->name, testcase->final_state.a, Regs.XR);
+        fprintf(out, "[%s:%u (\"%s\")] ERROR - X register check failed (expected: 0x%02x, sim65: 0x%02x).\n", filename, testcase_index, testcase->name, testcase->final_state.a, result->x);
         ++errors_seen;
     }
 
-    if (Regs.YR != testcase->final_state.y)
+    if (result->errors & SIM65_ERROR_Y)
     {
-        printf("[%s:%u (\"%s\")] ERROR - Y register check failed (expected: 0x%02x, sim65: 0x%02x).\n", filename, testcase_index, testcase->name, testcase->final_state.a, Regs.YR);
+        fprintf(out, "[%s:%u (\"%s\")] ERROR - Y register check failed (expected: 0x%02x, sim65: 0x%02x).\n", filename, testcase_index, testcase->name, testcase->final_state.a, result->y);
         ++errors_seen;
     }
 
-    if (Regs.SR != fix_p_register_value(testcase->final_state.p))
+    if (result->errors & SIM65_ERROR_P)
     {
-        printf("[%s:%u (\"%s\")] ERROR - P register check failed (expected: 0x%02x, sim65: 0x%02x).\n", filename, testcase_index, testcase->name, testcase->final_state.p, Regs.SR);
+        fprintf(out, "[%s:%u (\"%s\")] ERROR - P register check failed (expected: 0x%02x, sim65: 0x%02x).\n", filename, testcase_index, testcase->name, testcase->final_state.p, result->p);
         ++errors_seen;
     }
 
-    if (Regs.SP != testcase->final_state.s)
+    if (result->errors & SIM65_ERROR_S)
     {
-        printf("[%s:%u (\"%s\")] ERROR - S register check failed (expected: 0x%02x, sim65: 0x%02x).\n", filename, testcase_index, testcase->name, testcase->final_state.s, Regs.SP);
+        fprintf(out, "[%s:%u (\"%s\")] ERROR - S register check failed (expected: 0x%02x, sim65: 0x%02x).\n", filename, testcase_index, testcase->name, testcase->final_state.s, result->s);
         ++errors_seen;
     }
 
-    if (Regs.PC != testcase->final_state.pc)
+    if (result->errors & SIM65_ERROR_PC)
     {
-        printf("[%s:%u (\"%s\")] ERROR - PC register check failed (expected: 0x%04x, sim65: 0x%04x).\n", filename, testcase_index, testcase->name, testcase->final_state.s, Regs.PC);
+        fprintf(out, "[%s:%u (\"%s\")] ERROR - PC register check failed (expected: 0x%04x, sim65: 0x%04x).\n", filename, testcase_index, testcase->name, testcase->final_state.s, result->pc);
         ++errors_seen;
     }
 
-    if ((test_flags & F_TEST_CYCLECOUNT) && sim65_cyclecount != testcase->cycles)
+    if (result->errors & SIM65_ERROR_CYCLES)
     {
-        printf("[%s:%u (\"%s\")] ERROR - cycle count check failed (expected: %u, sim65: %u).\n", filename, testcase_index, testcase->name, testcase->cycles, sim65_cyclecount);
+        fprintf(out, "[%s:%u (\"%s\")] ERROR - cycle count check failed (expected: %u, sim65: %u).\n", filename, testcase_index, testcase->name, testcase->cycles, result->cycles);
         ++errors_seen;
     }
 
-    if ((test_flags & F_TEST_MEMORY) && memcmp(Mem, testcase->final_state.ram, 0x10000) != 0)
+    if (result->errors & SIM65_ERROR_MEMORY)
     {
-        unsigned address;
-        for (address = 0; testcase->final_state.ram[address] == Mem[address]; ++address)
-        {
-            // Find first address with a difference.
-        }
-        printf("[%s:%u (\"%s\")] ERROR - memory check failed: (address 0x%04x: expected 0x%02x, sim65: 0x%02x).\n", filename, testcase_index, testcase->name,
-            address, testcase->final_state.ram[address], Mem[address]);
+        fprintf(out, "[%s:%u (\"%s\")] ERROR - memory check failed: (address 0x%04x: expected 0x%02x, sim65: 0x%02x).\n", filename, testcase_index, testcase->name,
+            result->memory_address, result->memory_expected, result->memory_value);
         ++errors_seen;
     }
 
-    printf("[%s:%u (\"%s\")] INFO - Test summary: %u %s, %u %s.\n", filename, testcase_index, testcase->name,
+    if (result->errors & SIM65_ERROR_BUS)
+    {
+        char expected[32];
+        char actual[32];
+        format_bus_access(expected, sizeof(expected), (result->bus_cycle < testcase->cycles) ? &testcase->bus[result->bus_cycle] : NULL);
+        format_bus_access(actual, sizeof(actual), &result->bus_access);
+        fprintf(out, "[%s:%u (\"%s\")] ERROR - bus check failed in cycle %u (expected: %s, sim65: %s).\n", filename, testcase_index, testcase->name,
+            result->bus_cycle + 1, expected, actual);
+        ++errors_seen;
+    }
+
+    fprintf(out, "[%s:%u (\"%s\")] INFO - Test summary: %u %s, %u %s.\n", filename, testcase_index, testcase->name,
             errors_seen, (errors_seen != 1) ? "errors" : "error",
             notices_seen, (notices_seen != 1) ? "notices" : "notice");
 
     return errors_seen ? -1 : 0;
 }
+
+int execute_testcase(const struct sim65_testcase_specification_type * testcase, const char * filename, unsigned testcase_index, enum sim65_cpu_mode_type cpu_mode, unsigned test_flags, FILE * out)
+{
+    struct sim65_testcase_result_type result;
+
+    execute_testcase_batch(testcase, 1, cpu_mode, test_flags, &result);
+
+    return report_testcase_result(testcase, &result, filename, testcase_index, out);
+}
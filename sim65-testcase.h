@@ -6,10 +6,36 @@
 #ifndef SIM65_TESTCASE_H
 #define SIM65_TESTCASE_H
 
+#include <stdio.h>
 #include <stdint.h>
 
-#define F_TEST_MEMORY     0x00000001
-#define F_TEST_CYCLECOUNT 0x00000002
+#define F_TEST_MEMORY       0x00000001
+#define F_TEST_CYCLECOUNT   0x00000002
+#define F_TEST_BUS          0x00000004
+#define F_TEST_DIFFERENTIAL 0x00000008  // Compare with the reference core instead (see sim65-reference.h).
+#define F_TEST_RUN_LOOP     0x00000010  // Execute with RunInsns() instead of ExecuteInsn() (--engine=run).
+#define F_TEST_BLOCK_CACHE  0x00000020  // Execute with RunBlocks() instead of ExecuteInsn() (--engine=block).
+
+// A test case only specifies the RAM locations it uses; all other locations are zero.
+
+struct ram_assignment_type
+{
+    uint16_t address;
+    uint8_t value;
+};
+
+// The 65x02 test cases specify the memory access made in each cycle.
+
+#define SIM65_BUS_READ   0
+#define SIM65_BUS_WRITE  1
+#define SIM65_BUS_NONE   2  // No access; only used in results.
+
+struct bus_access_type
+{
+    uint16_t address;
+    uint8_t value;
+    uint8_t type;  // SIM65_BUS_READ or SIM65_BUS_WRITE.
+};
 
 struct machine_state_type
 {
@@ -19,15 +45,17 @@ struct machine_state_type
     uint8_t x;
     uint8_t y;
     uint8_t p;
-    uint8_t ram[0x10000];
+    unsigned ram_size;
+    const struct ram_assignment_type * ram;
 };
 
 struct sim65_testcase_specification_type
 {
-    char * name;
+    const char * name;
     struct machine_state_type initial_state;
     struct machine_state_type final_state;
     unsigned cycles;
+    const struct bus_access_type * bus;  // The access of each of the cycles; only needed for F_TEST_BUS.
 };
 
 enum sim65_cpu_mode_type {
@@ -36,6 +64,55 @@ enum sim65_cpu_mode_type {
     SIM65_CPU_6502X
 };
 
-int execute_testcase(struct sim65_testcase_specification_type * testcase, const char * filename, unsigned testcase_index, enum sim65_cpu_mode_type cpu_mode, unsigned test_flags);
+// The outcome of executing a test case, as determined by execute_testcase_batch().
+
+#define SIM65_NOTICE_ILLEGAL_INSTRUCTION  0x01  // sim65 called Error().
+#define SIM65_NOTICE_JMP_INDIRECT_BUG     0x02  // sim65 called Warning().
+#define SIM65_NOTICE_CYCLES_UNSPECIFIED   0x04  // The cycle count of the instruction is unspecified, and was not checked.
+
+#define SIM65_ERROR_A       0x01
+#define SIM65_ERROR_X       0x02
+#define SIM65_ERROR_Y       0x04
+#define SIM65_ERROR_P       0x08
+#define SIM65_ERROR_S       0x10
+#define SIM65_ERROR_PC      0x20
+#define SIM65_ERROR_CYCLES  0x40
+#define SIM65_ERROR_MEMORY  0x80
+#define SIM65_ERROR_BUS     0x100
+
+struct sim65_testcase_result_type
+{
+    uint16_t pc;              // Register values after execution.
+    uint8_t s;
+    uint8_t a;
+    uint8_t x;
+    uint8_t y;
+    uint8_t p;
+    uint8_t notices;          // SIM65_NOTICE_* flags.
+    uint16_t errors;          // SIM65_ERROR_* flags for the checks that failed.
+    uint8_t memory_value;     // With SIM65_ERROR_MEMORY: the value found at memory_address.
+    uint8_t memory_expected;  // With SIM65_ERROR_MEMORY: the value expected at memory_address.
+    uint16_t memory_address;  // With SIM65_ERROR_MEMORY: the lowest address that holds an unexpected value.
+    uint16_t cycles;          // Cycle count reported by sim65.
+    uint16_t bus_cycle;       // With SIM65_ERROR_BUS: the first cycle (from 0) in which the access differs.
+    struct bus_access_type bus_access;  // With SIM65_ERROR_BUS: the access sim65 made in that cycle.
+};
+
+// Execute the instruction at the PC of sim65, with the engine selected by the test flags (ExecuteInsn(), or the run
+// loop of F_TEST_RUN_LOOP or F_TEST_BLOCK_CACHE), and return the SIM65_NOTICE_* flags of what sim65 reported. The
+// cycle count of the instruction is stored in *cycles, or 0 if it is unspecified.
+uint8_t execute_instruction(unsigned test_flags, unsigned * cycles);
+
+// Execute a batch of test cases that share the CPU mode and test flags, storing the outcome of test case i in
+// results[i]. Nothing is printed. Returns the number of test cases with errors.
+int execute_testcase_batch(const struct sim65_testcase_specification_type * testcases, unsigned count, enum sim65_cpu_mode_type cpu_mode, unsigned test_flags,
+                           struct sim65_testcase_result_type * results);
+
+// Print the messages for the outcome of a test case. Returns -1 if the test case had errors, 0 otherwise.
+int report_testcase_result(const struct sim65_testcase_specification_type * testcase, const struct sim65_testcase_result_type * result,
+                           const char * filename, unsigned testcase_index, FILE * out);
+
+// Execute a single test case and print the messages for its outcome. Returns -1 if the test case had errors, 0 otherwise.
+int execute_testcase(const struct sim65_testcase_specification_type * testcase, const char * filename, unsigned testcase_index, enum sim65_cpu_mode_type cpu_mode, unsigned test_flags, FILE * out);
 
 #endif
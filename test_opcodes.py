@@ -5,7 +5,6 @@
 import argparse
 import os
 import subprocess
-import multiprocessing
 import itertools
 
 from make_testresult_dashboard import make_testresult_dashboard
@@ -67,20 +66,45 @@ sim65_supported_opcodes = {
             """
 }
 
+def testcase_file(testcase_directory, opcode) -> str:
+    """Return the test file for an opcode.
+
+    A binary file made by 'sim65-test --convert' is preferred if there is one, unless the JSON file it was made from
+    is newer; otherwise, the JSON file is used, either uncompressed or compressed with gzip or zstd.
+    """
+    json_filename = None
+    for extension in (".json", ".json.gz", ".json.zst"):
+        filename = os.path.join(testcase_directory, f"{opcode}{extension}")
+        if os.path.exists(filename):
+            json_filename = filename
+            break
+
+    bin_filename = os.path.join(testcase_directory, f"{opcode}.bin")
+    if os.path.exists(bin_filename):
+        if json_filename is None or os.path.getmtime(json_filename) <= os.path.getmtime(bin_filename):
+            return bin_filename
+        print("Binary file is older than its JSON file, using the JSON file:", bin_filename)
+
+    if json_filename is None:
+        return os.path.join(testcase_directory, f"{opcode}.json")
+
+    return json_filename
+
 def test_sim65_supported_opcodes(sim65_cpu_variant, testcase_directory) -> None:
 
     print("Starting test:", sim65_cpu_variant, testcase_directory)
 
     sim65_supported_opcodes_for_cpu = sim65_supported_opcodes[sim65_cpu_variant]
 
-    testfiles = [os.path.join(testcase_directory, f"{opcode}.json") for opcode in sim65_supported_opcodes_for_cpu.split() if opcode != ".."]
+    testfiles = [testcase_file(testcase_directory, opcode) for opcode in sim65_supported_opcodes_for_cpu.split() if opcode != ".."]
 
     executable = "./sim65-test"
 
     extra_args = []
     #extra_args = ["--disable-cycle-count-test"]
 
-    result = subprocess.run([executable, f"--cpu-mode={sim65_cpu_variant}"] + extra_args + testfiles, capture_output=True, encoding='ascii')
+    # sim65-test distributes the test files over all CPU cores.
+    result = subprocess.run([executable, "--jobs=0", "--output-format=jsonl", f"--cpu-mode={sim65_cpu_variant}"] + extra_args + testfiles, capture_output=True, encoding='ascii')
 
     assert result.returncode == 0
     assert len(result.stderr) == 0
@@ -103,8 +127,8 @@ def main() -> None:
         ("65C02", "65x02/wdc65c02/v1")
     )
 
-    pool = multiprocessing.Pool()
-    pool.starmap(test_sim65_supported_opcodes, sim65_cpu_variants_and_testcase_directories)
+    for (sim65_cpu_variant, testcase_directory) in sim65_cpu_variants_and_testcase_directories:
+        test_sim65_supported_opcodes(sim65_cpu_variant, testcase_directory)
 
     make_testresult_dashboard(sim65_cpu_variants_and_testcase_directories, "test_summary.html")
 
@@ -0,0 +1,17 @@
+
+// NOTE: This header is specific to sim65-test; it has no counterpart in sim65.
+//
+// sim65-test can execute test cases on several threads at once, each with its own simulated CPU, memory and
+// peripherals. To make that possible, the global state of 6502.c, memory.c and peripherals.c is declared with
+// SIM65_THREAD_LOCAL, which gives each thread its own copy when SIM65_THREADS is defined.
+
+#ifndef THREADLOCAL_H
+#define THREADLOCAL_H
+
+#if defined(SIM65_THREADS)
+#define SIM65_THREAD_LOCAL _Thread_local
+#else
+#define SIM65_THREAD_LOCAL
+#endif
+
+#endif